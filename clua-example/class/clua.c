@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+
+/*
+ * flattened class hierarchy
+ *
+ * a class is an empty proxy table, so every 'function C:m() end' goes
+ * through __newindex. the methods of a class are kept in its 'own' table and
+ * copied, together with everything its parent can see, into one 'flat' table.
+ * the flat table is the metatable (and __index) of the instances, so a method
+ * lookup is a single hash probe whatever the depth of the hierarchy.
+ *
+ * defining a method rebuilds the flat table of the class and of all classes
+ * derived from it, in place, so existing instances see the new method.
+ *
+ * the flat table's __metatable is the proxy: 'getmetatable(obj)' returns the
+ * class, so 'getmetatable(obj).m = f' defines a method like 'C.m = f' does,
+ * and the flat table itself is only written by 'flatten'.
+ *
+ * C bindings look methods up with lua_getfield, there is no inline cache: on
+ * a flat class that is one call making two probes (the instance, then the
+ * flat table). a cached method still has to check that the instance has no
+ * field of that name, so a hit costs a probe of the instance plus a registry
+ * fetch and the metatable check, three or more API calls, and measured slower.
+ */
+
+static const char *records = "class.records";
+
+/* the record (at index 'r') of a class has these fields */
+#define R_OWN "own"
+#define R_FLAT "flat"
+#define R_PARENT "parent"
+#define R_CHILDREN "children"
+
+/* rebuild the flat table of record at 'r' and of all its descendants */
+static void flatten(lua_State *L, int r) {
+  r = lua_absindex(L, r);
+  lua_getfield(L, r, R_FLAT);
+  int flat = lua_gettop(L);
+
+  /* clear it, keeping its identity since instances point to it */
+  lua_pushnil(L);
+  while (lua_next(L, flat)) {
+    lua_pop(L, 1);
+    lua_pushvalue(L, -1);
+    lua_pushnil(L);
+    lua_rawset(L, flat);
+  }
+
+  /* everything the parent sees, then our own methods on top */
+  if (lua_getfield(L, r, R_PARENT) == LUA_TTABLE) {
+    lua_getfield(L, -1, R_FLAT);
+    lua_pushnil(L);
+    while (lua_next(L, -2)) {
+      lua_pushvalue(L, -2);
+      lua_insert(L, -2);
+      lua_rawset(L, flat);
+    }
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+  lua_getfield(L, r, R_OWN);
+  lua_pushnil(L);
+  while (lua_next(L, -2)) {
+    lua_pushvalue(L, -2);
+    lua_insert(L, -2);
+    lua_rawset(L, flat);
+  }
+  lua_pop(L, 1);
+
+  lua_pushvalue(L, flat);
+  lua_setfield(L, flat, "__index");
+  lua_pop(L, 1);
+
+  lua_getfield(L, r, R_CHILDREN);
+  for (lua_Integer i = 1; lua_rawgeti(L, -1, i) == LUA_TTABLE; i++) {
+    flatten(L, -1);
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 2);
+}
+
+/* push the record of the class at 'idx' */
+static void getrecord(lua_State *L, int idx) {
+  idx = lua_absindex(L, idx);
+  lua_getfield(L, LUA_REGISTRYINDEX, records);
+  lua_pushvalue(L, idx);
+  if (lua_rawget(L, -2) != LUA_TTABLE) {
+    luaL_error(L, "not a class");
+  }
+  lua_remove(L, -2);
+}
+
+/* C.name = func */
+static int l_cnewindex(lua_State *L) {
+  getrecord(L, 1);
+  lua_getfield(L, -1, R_OWN);
+  lua_pushvalue(L, 2);
+  lua_pushvalue(L, 3);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+  flatten(L, -1);
+  return 0;
+}
+
+/* C(...) creates an instance and calls its 'init' method, if any */
+static int l_ccall(lua_State *L) {
+  int n = lua_gettop(L);
+  getrecord(L, 1);
+  lua_newtable(L);
+  lua_getfield(L, -2, R_FLAT);
+  lua_setmetatable(L, -2);
+  if (lua_getfield(L, -1, "init") == LUA_TFUNCTION) {
+    lua_pushvalue(L, -2);
+    for (int i = 2; i <= n; i++) {
+      lua_pushvalue(L, i);
+    }
+    lua_call(L, n, 0);
+  } else {
+    lua_pop(L, 1);
+  }
+  return 1;
+}
+
+/* class.define(name [, parent]) */
+static int l_define(lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  int hasparent = !lua_isnoneornil(L, 2);
+
+  lua_newtable(L); /* record */
+  int r = lua_gettop(L);
+  lua_newtable(L);
+  lua_setfield(L, r, R_OWN);
+  lua_newtable(L);
+  lua_pushstring(L, name);
+  lua_setfield(L, -2, "__name");
+  lua_setfield(L, r, R_FLAT);
+  lua_newtable(L);
+  lua_setfield(L, r, R_CHILDREN);
+  if (hasparent) {
+    getrecord(L, 2);
+    lua_getfield(L, -1, R_CHILDREN);
+    lua_pushvalue(L, r);
+    lua_rawseti(L, -2, luaL_len(L, -2) + 1);
+    lua_pop(L, 1);
+    lua_setfield(L, r, R_PARENT);
+  }
+  /* 'own' keeps __name so that re-flattening does not lose it */
+  lua_getfield(L, r, R_OWN);
+  lua_pushstring(L, name);
+  lua_setfield(L, -2, "__name");
+  lua_pop(L, 1);
+  flatten(L, r);
+
+  /* proxy */
+  lua_newtable(L);
+  lua_newtable(L);
+  lua_getfield(L, r, R_FLAT);
+  lua_setfield(L, -2, "__index");
+  lua_pushcfunction(L, l_cnewindex);
+  lua_setfield(L, -2, "__newindex");
+  lua_pushcfunction(L, l_ccall);
+  lua_setfield(L, -2, "__call");
+  lua_setmetatable(L, -2);
+
+  /* in 'own' too, so that re-flattening keeps it */
+  lua_getfield(L, r, R_OWN);
+  lua_pushvalue(L, -2);
+  lua_setfield(L, -2, "__metatable");
+  lua_getfield(L, r, R_FLAT);
+  lua_pushvalue(L, -3);
+  lua_setfield(L, -2, "__metatable");
+  lua_pop(L, 2);
+
+  lua_getfield(L, LUA_REGISTRYINDEX, records);
+  lua_pushvalue(L, -2);
+  lua_pushvalue(L, r);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+  return 1;
+}
+
+/* class.bench_getfield(obj, n): call obj:get() n times, resolved by name */
+static int l_bench_getfield(lua_State *L) {
+  lua_Integer n = luaL_checkinteger(L, 2);
+  clock_t start = clock();
+  for (lua_Integer i = 0; i < n; i++) {
+    lua_getfield(L, 1, "get");
+    lua_pushvalue(L, 1);
+    lua_call(L, 1, 1);
+    lua_pop(L, 1);
+  }
+  lua_pushnumber(L, (double)(clock() - start) / CLOCKS_PER_SEC);
+  return 1;
+}
+
+int main() {
+  lua_State *L = luaL_newstate();
+  luaL_openlibs(L);
+
+  {
+    static const luaL_Reg l[] = {
+      {"define", l_define},
+      {"bench_getfield", l_bench_getfield},
+      {NULL, NULL},
+    };
+    // proxy -> record, weak so that unused classes can be collected
+    lua_newtable(L);
+    lua_newtable(L);
+    lua_pushstring(L, "k");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    lua_setfield(L, LUA_REGISTRYINDEX, records);
+
+    luaL_newlib(L, l);
+    lua_setglobal(L, "class");
+  }
+
+  if (luaL_dofile(L, "./clua.lua") == LUA_OK) {
+    printf("[C] executed lua script\n");
+  } else {
+    printf("[C] lua script error: %s\n", lua_tostring(L, -1));
+  }
+
+  lua_close(L);
+  return 0;
+}
@@ -0,0 +1,125 @@
+-- same hierarchy as lua-example/metatable.lua, flattened by 'class'
+local point = class.define("point")
+
+function point:init(x, y)
+  self.x = x or 0
+  self.y = y or 0
+end
+
+function point:inc(xinc, yinc)
+  self.x = self.x + xinc
+  self.y = self.y + yinc
+end
+
+function point:dis()
+  print(string.format("x: %d, y : %d", self.x, self.y))
+end
+
+local line = class.define("line", point)
+
+function line:init(l)
+  self.x = point(l.xx, l.xy)
+  self.y = point(l.yx, l.yy)
+end
+
+function line:dis()
+  self.x:dis()
+  self.y:dis()
+end
+
+local l = line {xx = 1, xy = 2, yx = 11, yy = 12}
+l:dis()
+
+-- redefining a method of point rebuilds the flattened tables of point and
+-- line, existing instances see the new one
+function point:dis()
+  print(string.format("(%d, %d)", self.x, self.y))
+end
+l:dis()
+
+-- so does a method added to the parent after line was defined
+function point:name() return getmetatable(self).__name end
+print(l:name(), l.x:name())
+
+--------------------------------------------------------------------------
+
+-- metatable.lua style: every level is reached through another __index
+local function chained(depth)
+  local base = {}
+  base.__index = base
+  function base:get() return self.v end
+  local cls = base
+  for _ = 2, depth do
+    local sub = {}
+    sub.__index = sub
+    setmetatable(sub, {__index = cls})
+    cls = sub
+  end
+  return setmetatable({v = 1}, cls)
+end
+
+local function flattened(depth)
+  local base = class.define("c1")
+  function base:get() return self.v end
+  local cls = base
+  for i = 2, depth do
+    cls = class.define("c" .. i, cls)
+  end
+  local obj = cls()
+  obj.v = 1
+  return obj
+end
+
+-- a method resolved from C is the one obj.get would give
+local function counter()
+  local t = {calls = 0}
+  function t.get() t.calls = t.calls + 1 end
+  return t
+end
+
+do
+  -- a field of the instance hides the method of its class
+  local obj, own = flattened(2), counter()
+  obj.get = own.get
+  class.bench_getfield(obj, 5)
+  assert(own.calls == 5, "a field of the instance was ignored")
+
+  -- redefining a method of the base class
+  local base = class.define("checkbase")
+  function base:get() end
+  local sub = class.define("checksub", base)
+  obj = sub()
+  local new = counter()
+  base.get = new.get
+  class.bench_getfield(obj, 5)
+  assert(new.calls == 5, "a redefined method was missed")
+
+  -- getmetatable(obj) is the class, a method set through it is defined and
+  -- survives the flattening done by the next definition
+  new = counter()
+  getmetatable(obj).get = new.get
+  function base:other() end
+  class.bench_getfield(obj, 5)
+  assert(new.calls == 5, "a method set through getmetatable was lost")
+  assert(rawequal(getmetatable(obj), sub), "getmetatable(obj) is not the class")
+  print("class checks passed")
+end
+
+local function luacalls(obj, n)
+  local start = os.clock()
+  for _ = 1, n do obj:get() end
+  return os.clock() - start
+end
+
+local n = 2000000
+local function ns(t) return t * 1e9 / n end
+
+print(string.format("%-6s | %-12s | %-12s | %-12s | %-12s",
+  "depth", "lua chain", "lua flat", "C chain", "C flat"))
+for depth = 1, 8 do
+  local c, f = chained(depth), flattened(depth)
+  print(string.format("%-6d | %9.2f ns | %9.2f ns | %9.2f ns | %9.2f ns",
+    depth,
+    ns(luacalls(c, n)), ns(luacalls(f, n)),
+    ns(class.bench_getfield(c, n)), ns(class.bench_getfield(f, n))))
+end
@@ -1,5 +1,18 @@
+#include <stddef.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #include <lua.h>
 #include <lualib.h>
 #include <lauxlib.h>
@@ -97,10 +110,8 @@ int l_ldis(lua_State *L) {
   return 0;
 }
 
-int main() {
-  lua_State *L = luaL_newstate();
-  luaL_openlibs(L);
-
+// register 'point' and 'line'
+static void open_clua(lua_State *L) {
   {
     static const luaL_Reg l[] = {
       {"pnew", l_pnew},
@@ -152,8 +163,1163 @@ int main() {
 
     lua_setglobal(L, "line");
   }
+}
+
+static lua_State *clua_newstate(void) {
+  lua_State *L = luaL_newstate();
+  luaL_openlibs(L);
+  open_clua(L);
+  return L;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * bytecode cache
+ *
+ * 'clua_loadfile' loads a script from the 'lua_dump' of its compiled chunk,
+ * kept in CLUA_CACHE (default ./.cluacache) in a file named after the hash
+ * of the script's real path. the file starts with that path, and the mtime,
+ * size and content hash of the source it was compiled from:
+ *
+ * - same mtime and size: the chunk is used as is;
+ * - otherwise the source is hashed, and the chunk is still used (and its
+ *   header refreshed) if only the mtime changed;
+ * - otherwise the script is compiled again and the file replaced.
+ *
+ * the source is compiled like luaL_loadfile does, past a UTF-8 BOM and a '#'
+ * first line. the header also has the LUA_VERSION_NUM the chunk was dumped
+ * by and a hash of the chunk, checked when the file is mapped. a chunk that
+ * 'lua_load' still rejects (truncated, or from a build with another
+ * format) is dropped: the script is loaded from source and the cache file
+ * removed, so that the next load writes it again.
+ *
+ * a cache file is mapped once per process and every state loads from that
+ * mapping, 'lua_load' copies what it needs out of it. a mapping stays valid
+ * until 'cache_clear', even when a newer one shadows it.
+ */
+
+#define CACHE_MAGIC "CLUAC03"
+
+struct cache_header {
+  char magic[8];
+  int64_t version; // LUA_VERSION_NUM
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  int64_t size;
+  uint64_t hash; // of the source
+  uint64_t codehash; // of the chunk
+  int64_t pathlen; // the path follows, then the chunk
+};
+
+struct cache_entry {
+  struct cache_entry *next;
+  struct cache_header h;
+  const char *path; // in the mapping, the real path of the script
+  char *name;       // the path it was looked up by
+  char *file;
+  void *map;
+  size_t maplen;
+  const char *code;
+  size_t codelen;
+  int bad; // rejected by lua_load, shadowed by the next lookup
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cache_entry *cache_entries;
+
+static uint64_t fnv1a(const void *p, size_t n) {
+  const unsigned char *s = p;
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < n; i++) {
+    h = (h ^ s[i]) * 0x100000001b3ull;
+  }
+  return h;
+}
+
+// fnv1a over 8-byte words, for the chunk: one multiply per word
+static uint64_t chunk_hash(const void *p, size_t n) {
+  const unsigned char *s = p;
+  uint64_t h = 0xcbf29ce484222325ull;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t w;
+    memcpy(&w, s + i, 8);
+    h = (h ^ w) * 0x100000001b3ull;
+  }
+  return h ^ fnv1a(s + i, n - i);
+}
+
+static const char *cache_dir(void) {
+  const char *dir = getenv("CLUA_CACHE");
+  return dir ? dir : "./.cluacache";
+}
+
+// the cache file of the script at 'real', its real path
+static void cache_filename(char *buf, size_t sz, const char *real) {
+  snprintf(buf, sz, "%s/%016llx.luac", cache_dir(),
+           (unsigned long long)fnv1a(real, strlen(real)));
+}
+
+// the real path of 'path' in 'real' and its cache file in 'file', 0 if none
+static int cache_file(char *file, size_t sz, const char *path, char *real) {
+  if (realpath(path, real) == NULL) {
+    return 0;
+  }
+  cache_filename(file, sz, real);
+  return 1;
+}
+
+static int header_matches(const struct cache_header *h, const struct stat *st) {
+  return h->mtime_sec == st->st_mtim.tv_sec &&
+         h->mtime_nsec == st->st_mtim.tv_nsec && h->size == st->st_size;
+}
+
+static void header_fill(struct cache_header *h, const struct stat *st,
+                        uint64_t hash, uint64_t codehash, size_t pathlen) {
+  memset(h, 0, sizeof *h);
+  memcpy(h->magic, CACHE_MAGIC, sizeof CACHE_MAGIC);
+  h->version = LUA_VERSION_NUM;
+  h->mtime_sec = st->st_mtim.tv_sec;
+  h->mtime_nsec = st->st_mtim.tv_nsec;
+  h->size = st->st_size;
+  h->hash = hash;
+  h->codehash = codehash;
+  h->pathlen = pathlen;
+}
+
+// map a cache file, NULL if it is missing, damaged, from another Lua or
+// another path
+static struct cache_entry *cache_map(const char *file, const char *path) {
+  int fd = open(file, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size > sizeof(struct cache_header)) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) {
+    return NULL;
+  }
+  struct cache_entry *e = malloc(sizeof *e);
+  memcpy(&e->h, map, sizeof e->h);
+  e->path = (const char *)map + sizeof e->h;
+  e->map = map;
+  e->maplen = st.st_size;
+  size_t pathlen = strlen(path);
+  if (memcmp(e->h.magic, CACHE_MAGIC, sizeof CACHE_MAGIC) != 0 ||
+      e->h.version != LUA_VERSION_NUM ||
+      (size_t)e->h.pathlen != pathlen ||
+      sizeof e->h + pathlen > e->maplen ||
+      memcmp(e->path, path, pathlen) != 0) {
+    munmap(map, st.st_size);
+    free(e);
+    return NULL;
+  }
+  e->code = e->path + pathlen;
+  e->codelen = e->maplen - sizeof e->h - pathlen;
+  // once per mapping: undump does not catch a chunk damaged but parseable
+  if (chunk_hash(e->code, e->codelen) != e->h.codehash) {
+    munmap(map, st.st_size);
+    free(e);
+    return NULL;
+  }
+  e->name = NULL;
+  e->file = NULL;
+  e->bad = 0;
+  return e;
+}
+
+static void cache_free(struct cache_entry *e) {
+  munmap(e->map, e->maplen);
+  free(e->name);
+  free(e->file);
+  free(e);
+}
+
+static char *read_file(const char *path, size_t *len) {
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) {
+    return NULL;
+  }
+  long n = -1;
+  if (fseek(f, 0, SEEK_END) == 0) {
+    n = ftell(f);
+  }
+  if (n < 0 || fseek(f, 0, SEEK_SET) != 0) { // not a regular file
+    fclose(f);
+    return NULL;
+  }
+  char *buf = malloc(n > 0 ? n : 1);
+  *len = fread(buf, 1, n, f);
+  fclose(f);
+  return buf;
+}
+
+// skip a UTF-8 BOM and a first line starting with '#', as luaL_loadfile
+// does; the newline is kept so that line numbers do not change
+static const char *skip_prefix(const char *src, size_t *len) {
+  if (*len >= 3 && memcmp(src, "\xEF\xBB\xBF", 3) == 0) {
+    src += 3;
+    *len -= 3;
+  }
+  if (*len > 0 && *src == '#') {
+    const char *nl = memchr(src, '\n', *len);
+    size_t skip = nl ? (size_t)(nl - src) : *len;
+    src += skip;
+    *len -= skip;
+  }
+  return src;
+}
+
+struct dumpbuf {
+  char *p;
+  size_t n;
+  size_t cap;
+};
+
+static int dump_writer(lua_State *L, const void *p, size_t sz, void *ud) {
+  struct dumpbuf *b = ud;
+  if (b->n + sz > b->cap) {
+    while (b->n + sz > b->cap) {
+      b->cap = b->cap ? b->cap * 2 : 4096;
+    }
+    b->p = realloc(b->p, b->cap);
+  }
+  memcpy(b->p + b->n, p, sz);
+  b->n += sz;
+  return 0;
+}
+
+struct loadbuf {
+  const char *p;
+  size_t n;
+};
+
+static const char *load_reader(lua_State *L, void *ud, size_t *sz) {
+  struct loadbuf *b = ud;
+  if (b->n == 0) {
+    return NULL;
+  }
+  *sz = b->n;
+  b->n = 0;
+  return b->p;
+}
+
+// compile 'src' and write header, path and chunk to 'file'
+static int cache_write(lua_State *L, const char *file, const char *path,
+                       const char *real, const struct stat *st,
+                       const char *src, size_t len) {
+  char chunkname[1024];
+  snprintf(chunkname, sizeof chunkname, "@%s", path);
+  size_t codelen = len;
+  const char *code = skip_prefix(src, &codelen);
+  if (luaL_loadbufferx(L, code, codelen, chunkname, "t") != LUA_OK) {
+    lua_pop(L, 1); // the caller's luaL_loadfile reports it
+    return 0;
+  }
+  struct dumpbuf b = {NULL, 0, 0};
+  lua_dump(L, dump_writer, &b, 0);
+  lua_pop(L, 1);
+
+  struct cache_header h;
+  size_t pathlen = strlen(real);
+  header_fill(&h, st, fnv1a(src, len), chunk_hash(b.p, b.n), pathlen);
+  // write aside and rename, so that other processes never map half a file
+  char tmp[1100];
+  snprintf(tmp, sizeof tmp, "%s.%d", file, (int)getpid());
+  mkdir(cache_dir(), 0755);
+  FILE *f = fopen(tmp, "wb");
+  int ok = f != NULL && fwrite(&h, sizeof h, 1, f) == 1 &&
+           fwrite(real, 1, pathlen, f) == pathlen &&
+           fwrite(b.p, 1, b.n, f) == b.n;
+  if (f != NULL && fclose(f) != 0) {
+    ok = 0;
+  }
+  ok = ok && rename(tmp, file) == 0;
+  if (!ok) {
+    remove(tmp);
+  }
+  free(b.p);
+  return ok;
+}
+
+// the entry for 'path', NULL when the cache cannot be used
+static struct cache_entry *cache_lookup(lua_State *L, const char *path) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    return NULL;
+  }
+  pthread_mutex_lock(&cache_lock);
+  for (struct cache_entry *e = cache_entries; e != NULL; e = e->next) {
+    if (strcmp(e->name, path) == 0) {
+      if (!e->bad && header_matches(&e->h, &st)) {
+        pthread_mutex_unlock(&cache_lock);
+        return e;
+      }
+      break; // stale, shadow it
+    }
+  }
+
+  // the file is named after the real path, so that a shared CLUA_CACHE does
+  // not mix up scripts with the same relative path
+  char file[1024], real[PATH_MAX];
+  if (!cache_file(file, sizeof file, path, real)) {
+    pthread_mutex_unlock(&cache_lock);
+    return NULL;
+  }
+  struct cache_entry *e = cache_map(file, real);
+  char *src = NULL;
+  size_t len = 0;
+  if (e != NULL && !header_matches(&e->h, &st)) {
+    src = read_file(path, &len);
+    if (src != NULL && fnv1a(src, len) == e->h.hash) { // only touched
+      header_fill(&e->h, &st, e->h.hash, e->h.codehash, e->h.pathlen);
+      int fd = open(file, O_WRONLY);
+      if (fd >= 0) {
+        if (pwrite(fd, &e->h, sizeof e->h, 0) != sizeof e->h) {
+          perror("[C] cache");
+        }
+        close(fd);
+      }
+    } else {
+      cache_free(e);
+      e = NULL;
+    }
+  }
+  if (e == NULL) {
+    if (src == NULL) {
+      src = read_file(path, &len);
+    }
+    if (src != NULL && cache_write(L, file, path, real, &st, src, len)) {
+      e = cache_map(file, real);
+    }
+  }
+  free(src);
+  if (e != NULL) {
+    e->name = strdup(path);
+    e->file = strdup(file);
+    e->next = cache_entries;
+    cache_entries = e;
+  }
+  pthread_mutex_unlock(&cache_lock);
+  return e;
+}
+
+// unmap everything, as if the process restarted
+static void cache_clear(void) {
+  pthread_mutex_lock(&cache_lock);
+  while (cache_entries != NULL) {
+    struct cache_entry *e = cache_entries;
+    cache_entries = e->next;
+    cache_free(e);
+  }
+  pthread_mutex_unlock(&cache_lock);
+}
+
+// stop using a chunk that lua_load rejected, and remove its file
+static void cache_drop(struct cache_entry *e) {
+  pthread_mutex_lock(&cache_lock);
+  if (!e->bad) {
+    e->bad = 1;
+    remove(e->file);
+  }
+  pthread_mutex_unlock(&cache_lock);
+}
+
+// luaL_loadfile through the cache
+static int clua_loadfile(lua_State *L, const char *path) {
+  struct cache_entry *e = cache_lookup(L, path);
+  if (e == NULL) {
+    return luaL_loadfile(L, path);
+  }
+  char chunkname[1024];
+  snprintf(chunkname, sizeof chunkname, "@%s", path);
+  struct loadbuf b = {e->code, e->codelen};
+  if (lua_load(L, load_reader, &b, chunkname, "b") == LUA_OK) {
+    return LUA_OK;
+  }
+  lua_pop(L, 1);
+  cache_drop(e);
+  return luaL_loadfile(L, path);
+}
+
+/*
+ * profiler
+ *
+ * sampling: SIGPROF (setitimer, process CPU time) sets 'prof_tick' and arms a
+ * count hook with a count of 1 on the profiled state, as lua.c does on SIGINT
+ * (lua_sethook is safe in a signal handler). at the next instruction the hook
+ * takes the sample and removes itself: it walks the stack and adds one to the
+ * collapsed stack 'root;...;leaf', each Lua frame being 'function (src:line)'.
+ * between ticks no hook is set, since any hook puts the 5.4 VM in its slow
+ * tracing path. a coroutine other than the main thread is sampled when it
+ * yields back to it.
+ *
+ * the hook only runs between instructions, so a tick that lands inside a
+ * binding is taken when it returns and charged to the Lua line that called it.
+ * sampling alone leaves the bindings as they are: a wrapper around every call
+ * cost 7-25% on job.lua, without it sampling is within 1-4% of 'off again'.
+ *
+ * counting swaps the bindings of 'point' and 'line' for a trampoline that
+ * keeps the per-binding call counts and time (two clock reads a call, 80-95%
+ * on job.lua). while it is in, it also checks the tick flag when the binding
+ * returns and names the binding ('l_pinc') as the leaf of the sample.
+ *
+ * when both are off the hook is removed and the original functions put back,
+ * so a disabled profiler costs nothing.
+ *
+ * the profiler is process-wide: one timer, whose SIGPROF may land on any
+ * thread, one profiled state and one set of samples. so only the single-state
+ * host ('./clua' and './clua prof') opens it, never the states of the pool.
+ */
+
+#define PROF_MAXDEPTH 64
+
+struct binding {
+  const char *name; // in the metatable
+  const char *cname;
+  const char **meta;
+  lua_CFunction f;
+  _Atomic uint64_t calls;
+  _Atomic uint64_t ns; // cumulative, errors thrown by the binding are lost
+};
+
+static struct binding bindings[] = {
+  {"pnew", "l_pnew", &point, l_pnew, 0, 0},
+  {"pinc", "l_pinc", &point, l_pinc, 0, 0},
+  {"pdis", "l_pdis", &point, l_pdis, 0, 0},
+  {"lnew", "l_lnew", &line, l_lnew, 0, 0},
+  {"linc", "l_linc", &line, l_linc, 0, 0},
+  {"ldis", "l_ldis", &line, l_ldis, 0, 0},
+  {"lpoint", "l_lpoint", &line, l_lpoint, 0, 0},
+};
+
+#define NBINDING (sizeof bindings / sizeof bindings[0])
+
+static volatile sig_atomic_t prof_tick;
+static atomic_int prof_counting;
+static int prof_sampling;
+static lua_State *volatile prof_state;
+
+// collapsed stack -> number of samples
+struct prof_stack {
+  struct prof_stack *next;
+  uint64_t count;
+  char frames[];
+};
+
+#define PROF_NBUCKET 1024
+
+static pthread_mutex_t prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct prof_stack *prof_stacks[PROF_NBUCKET];
+static uint64_t prof_nsample;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void prof_add(const char *frames) {
+  size_t len = strlen(frames);
+  uint64_t h = fnv1a(frames, len) % PROF_NBUCKET;
+  pthread_mutex_lock(&prof_lock);
+  struct prof_stack *s = prof_stacks[h];
+  while (s != NULL && strcmp(s->frames, frames) != 0) {
+    s = s->next;
+  }
+  if (s == NULL) {
+    s = malloc(sizeof *s + len + 1);
+    memcpy(s->frames, frames, len + 1);
+    s->count = 0;
+    s->next = prof_stacks[h];
+    prof_stacks[h] = s;
+  }
+  s->count++;
+  prof_nsample++;
+  pthread_mutex_unlock(&prof_lock);
+}
+
+static int l_instrumented(lua_State *L);
+
+// name of the function at the top of the stack, described by 'ar'
+static void frame_name(lua_State *L, lua_Debug *ar, char *buf, size_t sz) {
+  if (*ar->what == 'C') {
+    lua_CFunction f = lua_tocfunction(L, -1);
+    if (f == l_instrumented) {
+      lua_getupvalue(L, -1, 1);
+      struct binding *b = lua_touserdata(L, -1);
+      lua_pop(L, 1);
+      snprintf(buf, sz, "%s", b->cname);
+      return;
+    }
+    for (size_t i = 0; i < NBINDING; i++) {
+      if (bindings[i].f == f) {
+        snprintf(buf, sz, "%s", bindings[i].cname);
+        return;
+      }
+    }
+    snprintf(buf, sz, "[C] %s", ar->name ? ar->name : "?");
+  } else {
+    const char *name = ar->name ? ar->name : *ar->what == 'm' ? "main chunk" : "?";
+    snprintf(buf, sz, "%s (%s:%d)", name, ar->short_src, ar->currentline);
+  }
+}
+
+static void prof_sample(lua_State *L) {
+  char names[PROF_MAXDEPTH][128];
+  lua_Debug ar;
+  int n = 0;
+  while (n < PROF_MAXDEPTH && lua_getstack(L, n, &ar)) {
+    lua_getinfo(L, "nSlf", &ar);
+    frame_name(L, &ar, names[n], sizeof names[n]);
+    lua_pop(L, 1);
+    n++;
+  }
+  char frames[PROF_MAXDEPTH * 129];
+  size_t len = 0;
+  for (int i = n - 1; i >= 0; i--) { // root first
+    len += snprintf(frames + len, sizeof frames - len, "%s%s", names[i], i > 0 ? ";" : "");
+  }
+  prof_add(frames);
+}
+
+static void prof_hook(lua_State *L, lua_Debug *ar) {
+  lua_sethook(L, NULL, 0, 0);
+  if (prof_tick) { // not already taken by a binding
+    prof_tick = 0;
+    prof_sample(L);
+  }
+}
+
+static int l_instrumented(lua_State *L) {
+  struct binding *b = lua_touserdata(L, lua_upvalueindex(1));
+  uint64_t start = now_ns();
+  int n = b->f(L);
+  atomic_fetch_add_explicit(&b->calls, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&b->ns, now_ns() - start, memory_order_relaxed);
+  if (prof_tick) { // the tick came while in the binding
+    prof_tick = 0;
+    prof_sample(L);
+  }
+  return n;
+}
+
+// put the trampolines in, or the original functions back
+static void prof_wrap(lua_State *L, int on) {
+  for (size_t i = 0; i < NBINDING; i++) {
+    struct binding *b = &bindings[i];
+    luaL_getmetatable(L, *b->meta);
+    if (on) {
+      lua_pushlightuserdata(L, b);
+      lua_pushcclosure(L, l_instrumented, 1);
+    } else {
+      lua_pushcfunction(L, b->f);
+    }
+    lua_setfield(L, -2, b->name);
+    lua_pop(L, 1);
+  }
+}
+
+static void prof_signal(int sig) {
+  prof_tick = 1;
+  if (prof_state != NULL) {
+    lua_sethook(prof_state, prof_hook, LUA_MASKCOUNT, 1);
+  }
+}
+
+static void prof_timer(int us) {
+  struct itimerval it;
+  it.it_interval.tv_sec = us / 1000000;
+  it.it_interval.tv_usec = us % 1000000;
+  it.it_value = it.it_interval;
+  setitimer(ITIMER_PROF, &it, NULL);
+}
+
+static void prof_start(lua_State *L, int us) {
+  if (!prof_sampling) {
+    prof_state = L;
+    signal(SIGPROF, prof_signal);
+    prof_timer(us);
+    prof_sampling = 1;
+  }
+}
+
+// stop sampling and write the collapsed stacks to 'path'
+static uint64_t prof_stop(lua_State *L, const char *path) {
+  if (prof_sampling) {
+    prof_timer(0);
+    signal(SIGPROF, SIG_DFL);
+    prof_state = NULL;
+    lua_sethook(L, NULL, 0, 0);
+    prof_sampling = 0;
+    prof_tick = 0;
+  }
+  FILE *f = path ? fopen(path, "w") : NULL;
+  pthread_mutex_lock(&prof_lock);
+  uint64_t n = prof_nsample;
+  for (int i = 0; i < PROF_NBUCKET; i++) {
+    while (prof_stacks[i] != NULL) {
+      struct prof_stack *s = prof_stacks[i];
+      if (f) {
+        fprintf(f, "%s %llu\n", s->frames, (unsigned long long)s->count);
+      }
+      prof_stacks[i] = s->next;
+      free(s);
+    }
+  }
+  prof_nsample = 0;
+  pthread_mutex_unlock(&prof_lock);
+  if (f) {
+    fclose(f);
+  }
+  return n;
+}
+
+static void prof_count(lua_State *L, int on) {
+  if (on && !atomic_load(&prof_counting)) {
+    for (size_t i = 0; i < NBINDING; i++) {
+      atomic_store(&bindings[i].calls, 0);
+      atomic_store(&bindings[i].ns, 0);
+    }
+  }
+  atomic_store(&prof_counting, on);
+  prof_wrap(L, on);
+}
+
+static void prof_report(void) {
+  printf("[C] %-10s | %10s | %10s | %8s\n", "binding", "calls", "total ms", "ns/call");
+  for (size_t i = 0; i < NBINDING; i++) {
+    uint64_t calls = atomic_load(&bindings[i].calls);
+    uint64_t ns = atomic_load(&bindings[i].ns);
+    if (calls > 0) {
+      printf("[C] %-10s | %10llu | %10.2f | %8.1f\n", bindings[i].cname,
+             (unsigned long long)calls, ns / 1e6, (double)ns / calls);
+    }
+  }
+}
+
+// profiler.start([interval_us]), profiler.stop([path]) -> samples,
+// profiler.count(on), profiler.report()
+static int l_profstart(lua_State *L) {
+  prof_start(L, (int)luaL_optinteger(L, 1, 1000));
+  return 0;
+}
+
+static int l_profstop(lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)prof_stop(L, luaL_optstring(L, 1, NULL)));
+  return 1;
+}
+
+static int l_profcount(lua_State *L) {
+  prof_count(L, lua_toboolean(L, 1));
+  return 0;
+}
+
+static int l_profreport(lua_State *L) {
+  prof_report();
+  return 0;
+}
+
+// only for the one state of the process, see above
+static void open_profiler(lua_State *L) {
+  static const luaL_Reg l[] = {
+    {"start", l_profstart},
+    {"stop", l_profstop},
+    {"count", l_profcount},
+    {"report", l_profreport},
+    {NULL, NULL},
+  };
+  luaL_newlib(L, l);
+  lua_setglobal(L, "profiler");
+}
+
+/*
+ * worker pool: one pre-created state per worker thread, 'point' and 'line'
+ * already registered.
+ *
+ * a job is the script called with its id. it runs with a fresh _ENV whose
+ * __index is the real globals, so what a job defines does not leak into the
+ * next one, and the state only gets a GC step in between instead of being
+ * rebuilt. each job loads its own closure of the script (from the bytecode
+ * cache, so without compiling it): the _ENV upvalue is shared by every
+ * closure the chunk creates, so setting it on a closure of an earlier job
+ * would also change what the functions that job left behind see.
+ *
+ * jobs are dealt round robin to per-worker queues; a worker takes from the
+ * back of its own and, when it runs dry, steals from the front of the others.
+ */
+
+struct job_queue {
+  pthread_mutex_t lock;
+  int *jobs;
+  int head; // thieves take from here
+  int tail; // the owner pushes and takes here
+};
+
+struct pool;
+
+struct worker {
+  struct pool *pool;
+  pthread_t thread;
+  lua_State *L;
+  int envmeta; // registry ref of { __index = _G }
+  struct job_queue q;
+  int ndone;
+  int nstolen;
+  int nerror;
+  double setup; // seconds spent preparing states for jobs
+};
+
+struct pool {
+  int n;
+  int fresh; // baseline: a new state for every job
+  const char *script;
+  struct worker *w;
+};
+
+static int queue_take(struct job_queue *q, int back, int *job) {
+  int ok = 0;
+  pthread_mutex_lock(&q->lock);
+  if (q->head < q->tail) {
+    *job = back ? q->jobs[--q->tail] : q->jobs[q->head++];
+    ok = 1;
+  }
+  pthread_mutex_unlock(&q->lock);
+  return ok;
+}
+
+static int next_job(struct worker *w, int *job) {
+  struct pool *p = w->pool;
+  if (queue_take(&w->q, 1, job)) {
+    return 1;
+  }
+  int self = w - p->w;
+  for (int i = 1; i < p->n; i++) {
+    if (queue_take(&p->w[(self + i) % p->n].q, 0, job)) {
+      w->nstolen++;
+      return 1;
+    }
+  }
+  return 0; // all jobs are queued before the workers start
+}
+
+// the metatable of the jobs' _ENV, once per state
+static void worker_init(struct worker *w) {
+  lua_State *L = w->L;
+  lua_newtable(L);
+  lua_pushglobaltable(L);
+  lua_setfield(L, -2, "__index");
+  w->envmeta = luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+static void run_job(struct worker *w, int id) {
+  double start = now();
+  if (w->pool->fresh) {
+    w->L = clua_newstate();
+    worker_init(w);
+  }
+  lua_State *L = w->L;
+  if (clua_loadfile(L, w->pool->script) != LUA_OK) {
+    printf("[C] job %d: %s\n", id, lua_tostring(L, -1));
+    lua_settop(L, 0);
+    w->nerror++;
+    w->ndone++;
+    w->setup += now() - start;
+    if (w->pool->fresh) {
+      lua_close(L);
+      w->L = NULL;
+    }
+    return;
+  }
+  lua_newtable(L);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, w->envmeta);
+  lua_setmetatable(L, -2);
+  lua_setupvalue(L, -2, 1); // _ENV
+  w->setup += now() - start;
+
+  lua_pushinteger(L, id);
+  if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+    printf("[C] job %d: %s\n", id, lua_tostring(L, -1));
+    w->nerror++;
+  } else if (lua_tointeger(L, -1) != 1) { // the script counts its runs in _ENV
+    printf("[C] job %d: _ENV was not reset\n", id);
+    w->nerror++;
+  }
+  lua_settop(L, 0);
+  w->ndone++;
+
+  start = now();
+  if (w->pool->fresh) {
+    lua_close(L);
+    w->L = NULL;
+  } else {
+    lua_gc(L, LUA_GCSTEP, 0);
+  }
+  w->setup += now() - start;
+}
+
+static void *worker_main(void *arg) {
+  struct worker *w = arg;
+  int job;
+  while (next_job(w, &job)) {
+    run_job(w, job);
+  }
+  return NULL;
+}
+
+static struct pool *pool_new(int n, const char *script, int fresh) {
+  struct pool *p = malloc(sizeof *p);
+  p->n = n;
+  p->fresh = fresh;
+  p->script = script;
+  p->w = calloc(n, sizeof *p->w);
+  for (int i = 0; i < n; i++) {
+    struct worker *w = &p->w[i];
+    w->pool = p;
+    pthread_mutex_init(&w->q.lock, NULL);
+    if (!fresh) {
+      w->L = clua_newstate();
+      worker_init(w);
+    }
+  }
+  return p;
+}
+
+// run jobs 1..njob, returns the wall time
+static double pool_run(struct pool *p, int njob) {
+  for (int i = 0; i < p->n; i++) {
+    struct worker *w = &p->w[i];
+    w->q.jobs = malloc(njob * sizeof(int));
+    w->q.head = w->q.tail = 0;
+    w->ndone = w->nstolen = w->nerror = 0;
+    w->setup = 0;
+  }
+  for (int id = 1; id <= njob; id++) {
+    struct job_queue *q = &p->w[id % p->n].q;
+    q->jobs[q->tail++] = id;
+  }
+  double start = now();
+  for (int i = 0; i < p->n; i++) {
+    pthread_create(&p->w[i].thread, NULL, worker_main, &p->w[i]);
+  }
+  for (int i = 0; i < p->n; i++) {
+    pthread_join(p->w[i].thread, NULL);
+  }
+  double elapsed = now() - start;
+  for (int i = 0; i < p->n; i++) {
+    free(p->w[i].q.jobs);
+  }
+  return elapsed;
+}
+
+static void pool_delete(struct pool *p) {
+  for (int i = 0; i < p->n; i++) {
+    if (p->w[i].L) {
+      lua_close(p->w[i].L);
+    }
+    pthread_mutex_destroy(&p->w[i].q.lock);
+  }
+  free(p->w);
+  free(p);
+}
+
+// 1, 2, 4, ... and 'max' last, even when it is not a power of two
+static int next_workers(int n, int max) {
+  return n < max && n * 2 > max ? max : n * 2;
+}
+
+// ./clua pool [njob [script [maxworker]]]
+static int pool_main(int argc, char *argv[]) {
+  int njob = argc > 0 ? atoi(argv[0]) : 20000;
+  const char *script = argc > 1 ? argv[1] : "./job.lua";
+  int maxworker = argc > 2 ? atoi(argv[2]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+  // compile it once up front: this reports a bad script and fills the cache
+  lua_State *L = clua_newstate();
+  int status = clua_loadfile(L, script);
+  if (status != LUA_OK) {
+    printf("[C] pool: %s\n", lua_tostring(L, -1));
+  }
+  lua_close(L);
+  if (status != LUA_OK) {
+    return 1;
+  }
+
+  printf("%-7s | %-6s | %10s | %8s | %14s | %6s\n", "workers", "states", "jobs/s",
+         "speedup", "setup/job (us)", "stolen");
+  double base[2] = {0, 0};
+  for (int n = 1; n <= maxworker; n = next_workers(n, maxworker)) {
+    for (int fresh = 1; fresh >= 0; fresh--) {
+      double t0 = now();
+      struct pool *p = pool_new(n, script, fresh);
+      double tcreate = now() - t0;
+      double elapsed = pool_run(p, njob);
+      double setup = 0;
+      int done = 0, stolen = 0, nerror = 0;
+      for (int i = 0; i < n; i++) {
+        setup += p->w[i].setup;
+        done += p->w[i].ndone;
+        stolen += p->w[i].nstolen;
+        nerror += p->w[i].nerror;
+      }
+      if (done != njob || nerror) {
+        printf("[C] pool: %d of %d jobs done, %d errors\n", done, njob, nerror);
+      }
+      double rate = njob / elapsed;
+      if (n == 1) {
+        base[fresh] = rate;
+      }
+      // the pool pays its setup once, up front
+      printf("%-7d | %-6s | %10.0f | %7.2fx | %14.2f | %6d\n", n, fresh ? "fresh" : "pool",
+             rate, rate / base[fresh], setup * 1e6 / njob, stolen);
+      if (!fresh) {
+        printf("%-7s | %-6s | pre-created in %.2f ms\n", "", "", tcreate * 1e3);
+      }
+      pool_delete(p);
+    }
+  }
+  return 0;
+}
+
+// a big script: 'nfunc' functions stored in a table
+static void generate_script(const char *path, int nfunc) {
+  FILE *f = fopen(path, "w");
+  if (f == NULL) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  fprintf(f, "local F = {}\n");
+  for (int i = 0; i < nfunc; i++) {
+    fprintf(f,
+            "F[%d] = function(p, n)\n"
+            "  local s = 0\n"
+            "  for i = 1, n do\n"
+            "    s = s + i * %d\n"
+            "    if s > %d then s = s - %d end\n"
+            "  end\n"
+            "  p:pinc(s %% 7, %d)\n"
+            "  return s, \"f%d\"\n"
+            "end\n",
+            i + 1, i % 13 + 1, 1000 + i, 997, i % 5, i);
+  }
+  fprintf(f, "return #F\n");
+  fclose(f);
+}
+
+enum { LOAD_SOURCE, LOAD_COLD, LOAD_RESTART, LOAD_SHARED };
+
+// average seconds per load of 'path'
+static double time_load(lua_State *L, const char *path, int how, int reps) {
+  char file[1024], real[PATH_MAX];
+  cache_file(file, sizeof file, path, real);
+  clua_loadfile(L, path); // the warm cases start from a filled cache
+  lua_pop(L, 1);
+  double total = 0;
+  for (int i = 0; i < reps; i++) {
+    if (how == LOAD_COLD) {
+      remove(file);
+    }
+    if (how == LOAD_COLD || how == LOAD_RESTART) {
+      cache_clear();
+    }
+    double start = now();
+    int status = how == LOAD_SOURCE ? luaL_loadfile(L, path) : clua_loadfile(L, path);
+    total += now() - start;
+    if (status != LUA_OK) {
+      printf("[C] cache: %s\n", lua_tostring(L, -1));
+    }
+    lua_pop(L, 1);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+  }
+  return total / reps;
+}
+
+// a damaged cache file must fall back to the source and then be rewritten
+static int cache_check(lua_State *L, const char *path) {
+  char file[1024], real[PATH_MAX];
+  if (!cache_file(file, sizeof file, path, real)) {
+    return 0;
+  }
+  int ok = 1;
+  for (int damage = 0; damage < 3; damage++) {
+    clua_loadfile(L, path);
+    lua_pop(L, 1);
+    cache_clear();
+    struct stat st;
+    if (stat(file, &st) != 0) {
+      return 0;
+    }
+    if (damage == 0) { // cut the chunk in half
+      ok = ok && truncate(file, st.st_size - (st.st_size - sizeof(struct cache_header)) / 2) == 0;
+    } else if (damage == 1) { // dumped by another Lua
+      int fd = open(file, O_WRONLY);
+      int64_t version = LUA_VERSION_NUM - 1;
+      ok = ok && fd >= 0 &&
+           pwrite(fd, &version, sizeof version, offsetof(struct cache_header, version)) == sizeof version;
+      if (fd >= 0) {
+        close(fd);
+      }
+    } else { // one byte of the chunk flipped, the size unchanged
+      int fd = open(file, O_RDWR);
+      unsigned char c = 0;
+      off_t at = st.st_size - 2;
+      ok = ok && fd >= 0 && pread(fd, &c, 1, at) == 1;
+      c ^= 0x40;
+      ok = ok && pwrite(fd, &c, 1, at) == 1;
+      if (fd >= 0) {
+        close(fd);
+      }
+    }
+    for (int i = 0; i < 2; i++) { // from source, then from the new file
+      if (clua_loadfile(L, path) != LUA_OK) {
+        printf("[C] cache: %s\n", lua_tostring(L, -1));
+        ok = 0;
+      }
+      lua_pop(L, 1);
+      cache_clear();
+    }
+    struct stat now_st;
+    ok = ok && stat(file, &now_st) == 0 && now_st.st_size == st.st_size;
+  }
+  return ok;
+}
+
+// ./clua cache [script ...]
+static int cache_main(int argc, char *argv[]) {
+  char generated[1024];
+  mkdir(cache_dir(), 0755);
+  snprintf(generated, sizeof generated, "%s/generated.lua", cache_dir());
+  generate_script(generated, 5000);
+  // loaded past its BOM and '#!' line, like luaL_loadfile does
+  char shebang[1024];
+  snprintf(shebang, sizeof shebang, "%s/shebang.lua", cache_dir());
+  FILE *f = fopen(shebang, "w");
+  if (f != NULL) {
+    fputs("\xEF\xBB\xBF#!/usr/bin/env lua\nlocal p = point:pnew(1, 2)\nreturn p\n", f);
+    fclose(f);
+  }
+  const char *defaults[] = {"./clua.lua", "./job.lua", generated, shebang};
+  if (argc == 0) {
+    argc = sizeof defaults / sizeof defaults[0];
+    argv = (char **)defaults;
+  }
+
+  lua_State *L = clua_newstate();
+  printf("%-28s | %8s | %10s | %10s | %10s | %10s | %7s\n", "script", "KB",
+         "source us", "cold us", "restart us", "shared us", "speedup");
+  for (int i = 0; i < argc; i++) {
+    const char *path = argv[i];
+    struct stat st;
+    if (stat(path, &st) != 0) {
+      printf("[C] cache: cannot stat %s\n", path);
+      continue;
+    }
+    int reps = st.st_size > (1 << 16) ? 10 : 200;
+    double source = time_load(L, path, LOAD_SOURCE, reps);
+    double cold = time_load(L, path, LOAD_COLD, reps);
+    double restart = time_load(L, path, LOAD_RESTART, reps);
+    double shared = time_load(L, path, LOAD_SHARED, reps);
+    printf("%-28s | %8.1f | %10.1f | %10.1f | %10.1f | %10.1f | %6.1fx\n", path,
+           st.st_size / 1024.0, source * 1e6, cold * 1e6, restart * 1e6,
+           shared * 1e6, source / restart);
+  }
+  for (int i = 0; i < argc; i++) {
+    if (!cache_check(L, argv[i])) {
+      printf("[C] cache: %s was not recovered from a damaged cache file\n", argv[i]);
+    }
+  }
+  lua_close(L);
+  cache_clear();
+  return 0;
+}
+
+// call the chunk 'ref' with 1..runs, returns seconds
+static double run_chunk(lua_State *L, int ref, int runs) {
+  double start = now();
+  for (int i = 1; i <= runs; i++) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+    lua_pushinteger(L, i);
+    if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+      printf("[C] prof: %s\n", lua_tostring(L, -1));
+      lua_pop(L, 1);
+      break;
+    }
+  }
+  return now() - start;
+}
+
+#define PROF_ROUNDS 5
+
+// ./clua prof [script [out [runs]]]
+static int prof_main(int argc, char *argv[]) {
+  const char *script = argc > 0 ? argv[0] : "./job.lua";
+  const char *out = argc > 1 ? argv[1] : "./clua.folded";
+  int runs = argc > 2 ? atoi(argv[2]) : 5000;
+
+  lua_State *L = clua_newstate();
+  open_profiler(L);
+  if (clua_loadfile(L, script) != LUA_OK) {
+    printf("[C] prof: %s\n", lua_tostring(L, -1));
+    lua_close(L);
+    return 1;
+  }
+  int ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+  // the modes take turns and the best round counts, a single run of each
+  // varies by more than the overhead of sampling
+  double off = 0, counting = 0, sampling = 0, again = 0;
+  uint64_t n = 0;
+  for (int round = 0; round < PROF_ROUNDS; round++) {
+    int last = round == PROF_ROUNDS - 1;
+    double t = run_chunk(L, ref, runs);
+    off = round == 0 || t < off ? t : off;
+    prof_count(L, 1);
+    t = run_chunk(L, ref, runs);
+    counting = round == 0 || t < counting ? t : counting;
+    prof_count(L, 0);
+    prof_start(L, 1000);
+    t = run_chunk(L, ref, runs);
+    sampling = round == 0 || t < sampling ? t : sampling;
+    n = prof_stop(L, last ? out : NULL);
+    t = run_chunk(L, ref, runs); // disabled after having been on
+    again = round == 0 || t < again ? t : again;
+  }
+  prof_report();
+
+  printf("[C] %llu samples written to %s\n", (unsigned long long)n, out);
+  printf("[C] %-10s | %10s | %8s\n", "profiler", "ms", "overhead");
+  printf("[C] %-10s | %10.2f | %7.1f%%\n", "off", off * 1e3, 0.0);
+  printf("[C] %-10s | %10.2f | %7.1f%%\n", "counting", counting * 1e3, (counting / off - 1) * 100);
+  printf("[C] %-10s | %10.2f | %7.1f%%\n", "sampling", sampling * 1e3, (sampling / off - 1) * 100);
+  printf("[C] %-10s | %10.2f | %7.1f%%\n", "off again", again * 1e3, (again / off - 1) * 100);
+  lua_close(L);
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc > 1 && strcmp(argv[1], "pool") == 0) {
+    return pool_main(argc - 2, argv + 2);
+  }
+  if (argc > 1 && strcmp(argv[1], "cache") == 0) {
+    return cache_main(argc - 2, argv + 2);
+  }
+  if (argc > 1 && strcmp(argv[1], "prof") == 0) {
+    return prof_main(argc - 2, argv + 2);
+  }
+
+  lua_State *L = clua_newstate();
+  open_profiler(L);
 
-  if (luaL_dofile(L, "./clua.lua") == LUA_OK) {
+  if ((clua_loadfile(L, "./clua.lua") || lua_pcall(L, 0, LUA_MULTRET, 0)) == LUA_OK) {
     printf("[C] executed lua script\n");
   } else {
     printf("[C] lua script error: %s\n", lua_tostring(L, -1));
@@ -161,5 +1327,6 @@ int main() {
 
   printf("[C] execute\n");
 
+  lua_close(L);
   return 0;
 }
@@ -0,0 +1,22 @@
+-- one job of './clua pool': called with its id, in a fresh _ENV
+runs = (runs or 0) + 1
+
+local id = ...
+local l = line:lnew()
+for i = 1, 100 * (id % 4 + 1) do
+  l:linc(i % 2, 1, 2)
+  local p = point:pnew(i, -i)
+  p:pinc(1, 1)
+end
+
+-- a function left behind in shared state must keep the _ENV of its own job
+-- (only in a fresh _ENV: './clua prof' reruns the job in a single one)
+tag = id
+local earlier = point.lastjob
+point.lastjob = function() return tag end
+if runs == 1 and earlier ~= nil and earlier() == id then
+  error("a function of an earlier job sees this job's _ENV")
+end
+
+-- the host checks that no earlier job's 'runs' was seen
+return runs
@@ -28,7 +28,58 @@ function chain.create(value)
   })
 end
 
+--------------------------------------------------------------------------
+
+-- every chain created by 'chain.new' shares this prototype, so a chain costs
+-- one table (the value cell) and each call is a plain function lookup through
+-- a single '__index' table instead of '__index' + '__call' dispatch
+local proto = {}
+proto.__index = proto
+
+function proto:add(inc)
+  self._val = self._val + inc
+  return self
+end
+
+function proto:mul(inc)
+  self._val = self._val * inc
+  return self
+end
+
+function proto:value() return self._val end
+
+function chain.new(value)
+  return setmetatable({ _val = value }, proto)
+end
+
 -- 20
 print(chain.create(2):add(3):add(5):mul(2):value())
 -- nil
 print(chain.create():value())
+
+-- 20
+print(chain.new(2):add(3):add(5):mul(2):value())
+-- nil
+print(chain.new():value())
+
+--------------------------------------------------------------------------
+
+local function bench(name, create, count)
+  collectgarbage()
+  collectgarbage("stop")
+  local mem = collectgarbage("count")
+  local start = os.clock()
+  for i = 1, count do
+    create(i):add(3):add(5):mul(2):value()
+  end
+  local elapsed = os.clock() - start
+  local kb = collectgarbage("count") - mem
+  collectgarbage("restart")
+  -- four chained calls per created chain
+  print(string.format("%-14s | %10.2f Mcalls/s | %8.1f bytes/chain",
+    name, count * 4 / elapsed / 1e6, kb * 1024 / count))
+end
+
+local count = 200000
+bench("chain.create", chain.create, count)
+bench("chain.new", chain.new, count)
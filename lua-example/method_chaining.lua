@@ -36,6 +36,38 @@ function listset:foreach()
   end
 end
 
+-- stateless version of 'foreach': the generic for keeps all state in its
+-- control variable, a cursor packing the row index (31 bits) and the column
+-- index (32 bits), so no closure is created per loop. '#row' is only read
+-- when 'row[j]' is nil, to tell a hole in the row from its end
+local JBITS = 32
+local JMASK = (1 << JBITS) - 1
+local IMAX = (1 << 31) - 1
+
+local function nextcell(self, cursor)
+  local i, j = cursor >> JBITS, (cursor & JMASK) + 1
+  local row = i > 0 and self[i]
+  while true do
+    if row then
+      local v = row[j]
+      if v ~= nil or j <= #row then
+        return (i << JBITS) | j, i, j, v
+      end
+    end
+    -- current row exhausted, move to the next one
+    i = i + 1
+    if i > #self then return nil end
+    if i > IMAX then error("listset too large for cells") end
+    row = self[i]
+    j = 1
+  end
+end
+
+-- usage: for _, i, j, v in set:cells() do ... end
+function listset:cells()
+  return nextcell, self, 0
+end
+
 listset {1,2,3} {2,3,4} {3,4,5} {4,5,6} {5,6,7} : dump()
 
 for i, j, v in listset
@@ -46,3 +78,65 @@ for i, j, v in listset
   print(i, j, v)
 end
 
+for _, i, j, v in listset:cells() do
+  print(i, j, v)
+end
+
+-- past the 21 bits per index of an earlier cursor: more rows than that, and a
+-- row longer than that
+do
+  local wide, tall = {}, {}
+  for j = 1, (1 << 21) + 2 do wide[j] = j end
+  for i = 1, (1 << 21) + 2 do tall[i] = false end
+  tall[#tall] = {"last"}
+  local n, last = 0
+  for _, _, _, v in listset.cells({{}, wide, {1, 2, 3}}) do n, last = n + 1, v end
+  assert(n == #wide + 3 and last == 3, "cells missed elements")
+  for _, i, j, v in listset.cells(tall) do last = {i, j, v} end
+  assert(last[1] == #tall and last[2] == 1 and last[3] == "last", "cells missed rows")
+end
+
+--------------------------------------------------------------------------
+
+local function time(func)
+  local start = os.clock()
+  func()
+  return os.clock() - start
+end
+
+local function benchmark(total, width)
+  local rows = {}
+  for i = 1, total // width do
+    local row = {}
+    for j = 1, width do row[j] = j end
+    rows[i] = row
+  end
+
+  local sum = 0
+  local results = {
+    { "foreach", time(function()
+      for _, _, v in listset.foreach(rows) do sum = sum + v end
+    end) },
+    { "cells", time(function()
+      for _, _, _, v in listset.cells(rows) do sum = sum + v end
+    end) },
+    { "numeric for", time(function()
+      for i = 1, #rows do
+        local row = rows[i]
+        for j = 1, #row do sum = sum + row[j] end
+      end
+    end) },
+  }
+  for _, r in ipairs(results) do
+    print(string.format("%-12s | %-10d | %8.2f ns/elem", r[1], total, r[2] * 1e9 / total))
+  end
+end
+
+-- pass the largest element count as first argument (up to 1e8, needs several GB)
+local limit = tonumber(arg and arg[1]) or 1e7
+local total = 1000000
+while total <= limit do
+  benchmark(total, 1000)
+  collectgarbage()
+  total = total * 10
+end
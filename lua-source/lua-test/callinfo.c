@@ -0,0 +1,471 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* inspired by lstate.c and ldo.c */
+
+/*
+ * a standalone stack/frame manager: 'L->stack' grows by realloc (pointers
+ * into it are saved as offsets and restored, see StkIdRel and stk_realloc.c),
+ * and every call pushes a CallInfo whose 'func'/'top' delimit its frame, with
+ * 'L->stack <= ci->func < L->top <= ci->top <= L->stack_last'.
+ *
+ * three ways to get a CallInfo:
+ *
+ * - malloc: one malloc per call and one free per return (the baseline);
+ * - list:   Lua 5.4, a doubly linked list where 'luaE_extendCI' mallocs a
+ *           node the first time a depth is reached and keeps it;
+ * - pool:   one contiguous array (as in Lua 5.1's 'base_ci'), 'L->ci' just
+ *           moves up and down and the array doubles when full.
+ *
+ * each thread records its high-water marks (deepest CallInfo, most stack
+ * slots). when a thread is freed they go into the hint of its 'kind' (the
+ * function the coroutine was created for), and a new thread of that kind can
+ * start with stack and CallInfo array already that big.
+ */
+
+/* type definition */
+
+#define cast(t, v) ((t)(v))
+#define cast_int(v) cast(int, v)
+
+#define INTERNAL_API static
+#define EXTERNAL_API extern
+
+typedef struct TValue {
+  int64_t i;
+  int tt_;
+} TValue;
+
+typedef TValue *StkId;
+
+/* a pointer into the stack, or its offset while the stack is reallocated */
+typedef union StkIdRel {
+  StkId p;
+  ptrdiff_t offset;
+} StkIdRel;
+
+#define setivalue(o, v) ((o)->i = (v), (o)->tt_ = 1)
+
+typedef struct CallInfo {
+  StkIdRel func; /* function index in the stack */
+  StkIdRel top;  /* top for this function */
+  struct CallInfo *previous, *next; /* dynamic call link, not in 'pool' */
+} CallInfo;
+
+enum { M_MALLOC, M_LIST, M_POOL, NMODES };
+static const char *modename[NMODES] = {"malloc", "list", "pool"};
+
+#define LUA_MINSTACK 20
+#define BASIC_STACK_SIZE (2 * LUA_MINSTACK)
+#define EXTRA_STACK 5
+#define LUAI_MAXSTACK 1000000
+#define BASIC_CI_SIZE 8
+
+#define NKINDS 4
+#define KMAIN NKINDS /* the main thread, it has no hint */
+
+typedef struct State {
+  int mode;
+  int kind;
+  StkId top; /* first free slot in the stack */
+  StkId stack;
+  StkId stack_last; /* end of stack (last element + 1) */
+  CallInfo *ci;     /* call info for current function */
+  CallInfo base_ci; /* CallInfo for first level ('malloc' and 'list') */
+  CallInfo *cis;    /* the array of CallInfo ('pool') */
+  int size_ci;
+  int nci;      /* number of CallInfo in use, 'base_ci' excluded */
+  int hwm_ci;   /* high-water marks */
+  int hwm_stack;
+  int nrealloc; /* stack and CallInfo array reallocations */
+} State;
+
+#define stacksize(L) cast_int((L)->stack_last - (L)->stack)
+
+/* high-water marks of the freed threads, per kind */
+typedef struct Hint {
+  int threads;
+  int ci;
+  int stack;
+} Hint;
+
+static Hint hints[NKINDS + 1];
+
+/* auxiliary function */
+
+INTERNAL_API void error(const char *msg) {
+  fprintf(stderr, "error: %s\n", msg);
+  exit(EXIT_FAILURE);
+}
+
+INTERNAL_API double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast(double, ts.tv_sec) + cast(double, ts.tv_nsec) * 1e-9;
+}
+
+/*
+ * ===================================================================
+ * stack
+ * ===================================================================
+ */
+
+/* change all pointers to the stack into offsets */
+INTERNAL_API void relstack(State *L, ptrdiff_t *topoff) {
+  *topoff = L->top - L->stack;
+  if (L->mode == M_POOL) {
+    for (CallInfo *ci = L->cis; ci <= L->ci; ci++) {
+      ci->top.offset = ci->top.p - L->stack;
+      ci->func.offset = ci->func.p - L->stack;
+    }
+  } else {
+    for (CallInfo *ci = L->ci; ci != NULL; ci = ci->previous) {
+      ci->top.offset = ci->top.p - L->stack;
+      ci->func.offset = ci->func.p - L->stack;
+    }
+  }
+}
+
+/* change back all offsets into pointers */
+INTERNAL_API void correctstack(State *L, ptrdiff_t topoff) {
+  L->top = L->stack + topoff;
+  if (L->mode == M_POOL) {
+    for (CallInfo *ci = L->cis; ci <= L->ci; ci++) {
+      ci->top.p = L->stack + ci->top.offset;
+      ci->func.p = L->stack + ci->func.offset;
+    }
+  } else {
+    for (CallInfo *ci = L->ci; ci != NULL; ci = ci->previous) {
+      ci->top.p = L->stack + ci->top.offset;
+      ci->func.p = L->stack + ci->func.offset;
+    }
+  }
+}
+
+INTERNAL_API void reallocstack(State *L, int newsize) {
+  ptrdiff_t topoff;
+  relstack(L, &topoff);
+  StkId newstack = cast(StkId, realloc(L->stack, (newsize + EXTRA_STACK) *
+                                                     sizeof(TValue)));
+  if (newstack == NULL) {
+    error("not enough memory");
+  }
+  L->stack = newstack;
+  L->stack_last = newstack + newsize;
+  correctstack(L, topoff);
+  L->nrealloc++;
+}
+
+/* grow the stack to have at least 'n' free slots */
+INTERNAL_API void growstack(State *L, int n) {
+  int size = stacksize(L);
+  int needed = cast_int(L->top - L->stack) + n;
+  int newsize = 2 * size;
+  if (newsize < needed) {
+    newsize = needed;
+  }
+  if (needed > LUAI_MAXSTACK) {
+    error("stack overflow");
+  }
+  if (newsize > LUAI_MAXSTACK) {
+    newsize = LUAI_MAXSTACK;
+  }
+  reallocstack(L, newsize);
+}
+
+#define checkstack(L, n)                                                       \
+  if ((L)->stack_last - (L)->top <= (n)) {                                     \
+    growstack(L, n);                                                           \
+  }
+
+/*
+ * ===================================================================
+ * CallInfo
+ * ===================================================================
+ */
+
+INTERNAL_API CallInfo *extendCI(State *L) {
+  CallInfo *ci = cast(CallInfo *, malloc(sizeof(CallInfo)));
+  L->ci->next = ci;
+  ci->previous = L->ci;
+  ci->next = NULL;
+  return ci;
+}
+
+INTERNAL_API void growCI(State *L) {
+  int newsize = 2 * L->size_ci;
+  CallInfo *cis = cast(CallInfo *, realloc(L->cis, newsize * sizeof(CallInfo)));
+  if (cis == NULL) {
+    error("not enough memory");
+  }
+  L->ci = cis + (L->ci - L->cis);
+  L->cis = cis;
+  L->size_ci = newsize;
+  L->nrealloc++;
+}
+
+INTERNAL_API CallInfo *nextci(State *L) {
+  CallInfo *ci;
+  switch (L->mode) {
+  case M_MALLOC:
+    ci = cast(CallInfo *, malloc(sizeof(CallInfo)));
+    ci->previous = L->ci;
+    break;
+  case M_LIST:
+    ci = L->ci->next ? L->ci->next : extendCI(L);
+    break;
+  default:
+    if (L->ci + 1 == L->cis + L->size_ci) {
+      growCI(L);
+    }
+    ci = L->ci + 1;
+    break;
+  }
+  L->ci = ci;
+  if (++L->nci > L->hwm_ci) {
+    L->hwm_ci = L->nci;
+  }
+  return ci;
+}
+
+INTERNAL_API void prevci(State *L) {
+  CallInfo *ci = L->ci;
+  switch (L->mode) {
+  case M_MALLOC:
+    L->ci = ci->previous;
+    free(ci);
+    break;
+  case M_LIST:
+    L->ci = ci->previous;
+    break;
+  default:
+    L->ci = ci - 1;
+    break;
+  }
+  L->nci--;
+}
+
+/* push a frame with 'framesize' slots above its function */
+INTERNAL_API StkId precall(State *L, int framesize) {
+  checkstack(L, framesize + 1);
+  CallInfo *ci = nextci(L);
+  ci->func.p = L->top;
+  setivalue(ci->func.p, framesize);
+  ci->top.p = L->top = ci->func.p + 1 + framesize;
+  int used = cast_int(L->top - L->stack);
+  if (used > L->hwm_stack) {
+    L->hwm_stack = used;
+  }
+  return ci->func.p;
+}
+
+INTERNAL_API void poscall(State *L) {
+  L->top = L->ci->func.p;
+  prevci(L);
+}
+
+/*
+ * ===================================================================
+ * threads
+ * ===================================================================
+ */
+
+/* a new thread of 'kind'; with 'usehint', sized by the earlier ones */
+EXTERNAL_API State *newthread(int mode, int kind, int usehint) {
+  State *L = cast(State *, malloc(sizeof(State)));
+  int size = BASIC_STACK_SIZE;
+  int size_ci = BASIC_CI_SIZE;
+  if (usehint && hints[kind].threads > 0) {
+    if (hints[kind].stack + 1 > size) { /* 'checkstack' keeps a spare slot */
+      size = hints[kind].stack + 1;
+    }
+    if (hints[kind].ci + 1 > size_ci) {
+      size_ci = hints[kind].ci + 1;
+    }
+  }
+  memset(L, 0, sizeof(State));
+  L->mode = mode;
+  L->kind = kind;
+  L->stack = cast(StkId, malloc((size + EXTRA_STACK) * sizeof(TValue)));
+  L->stack_last = L->stack + size;
+  L->top = L->stack;
+  if (mode == M_POOL) {
+    L->cis = cast(CallInfo *, malloc(size_ci * sizeof(CallInfo)));
+    L->size_ci = size_ci;
+    L->ci = L->cis;
+  } else {
+    L->ci = &L->base_ci;
+  }
+  /* the entry function */
+  L->ci->previous = L->ci->next = NULL;
+  L->ci->func.p = L->top;
+  setivalue(L->top, 0);
+  L->top++;
+  L->ci->top.p = L->top + LUA_MINSTACK;
+  return L;
+}
+
+EXTERNAL_API void freethread(State *L) {
+  Hint *h = &hints[L->kind];
+  h->threads++;
+  if (L->hwm_ci > h->ci) {
+    h->ci = L->hwm_ci;
+  }
+  if (L->hwm_stack > h->stack) {
+    h->stack = L->hwm_stack;
+  }
+  if (L->mode == M_LIST) {
+    CallInfo *ci = L->base_ci.next;
+    while (ci != NULL) {
+      CallInfo *next = ci->next;
+      free(ci);
+      ci = next;
+    }
+  }
+  free(L->cis);
+  free(L->stack);
+  free(L);
+}
+
+/*
+ * ===================================================================
+ * workloads
+ * ===================================================================
+ */
+
+/* a Lua-like function: fills its frame, calls itself 'depth' times */
+INTERNAL_API int64_t deep(State *L, int depth, int framesize) {
+  StkId func = precall(L, framesize);
+  for (int i = 1; i <= framesize; i++) {
+    setivalue(func + i, depth + i);
+  }
+  int64_t r = depth;
+  if (depth > 0) {
+    r += deep(L, depth - 1, framesize);
+  }
+  /* the stack may have moved, 'func' is stale: read it from 'ci' again */
+  func = L->ci->func.p;
+  r += func[framesize].i - depth;
+  poscall(L);
+  return r;
+}
+
+/* 'fanout' calls per level, 'levels' levels */
+INTERNAL_API int64_t wide(State *L, int levels, int fanout, int framesize) {
+  StkId func = precall(L, framesize);
+  for (int i = 1; i <= framesize; i++) {
+    setivalue(func + i, i);
+  }
+  int64_t r = 1;
+  if (levels > 0) {
+    for (int i = 0; i < fanout; i++) {
+      r += wide(L, levels - 1, fanout, framesize);
+    }
+  }
+  poscall(L);
+  return r;
+}
+
+/* expected results, checked against every mode */
+INTERNAL_API int64_t deep_result(int depth, int framesize) {
+  int64_t r = 0;
+  for (int d = 0; d <= depth; d++) {
+    r += d + framesize;
+  }
+  return r;
+}
+
+/* coroutines of kind 'k' recurse this deep */
+static const int kinddepth[NKINDS] = {4, 32, 128, 512};
+#define COFRAME 12
+
+INTERNAL_API void test_modes() {
+  for (int mode = 0; mode < NMODES; mode++) {
+    State *L = newthread(mode, KMAIN, 0);
+    assert(deep(L, 5000, 10) == deep_result(5000, 10));
+    assert(L->nci == 0 && L->top == L->stack + 1);
+    assert(L->hwm_ci == 5001);
+    assert(L->hwm_stack == 1 + 5001 * 11);
+    assert(wide(L, 4, 3, 4) == 1 + 3 + 9 + 27 + 81);
+    assert(L->hwm_ci == 5001);
+    freethread(L);
+    printf("%s: passed\n", modename[mode]);
+  }
+  memset(hints, 0, sizeof(hints));
+}
+
+INTERNAL_API void bench(int depth, int levels, int ncoro) {
+  int64_t wide_calls = 0;
+  for (int64_t n = 1, l = 0; l <= levels; l++, n *= 2) {
+    wide_calls += n;
+  }
+  printf("deep: %d frames, wide: %lld calls, coroutines: %d\n", depth,
+         cast(long long, wide_calls), ncoro);
+  printf("%-10s | %12s | %12s | %12s | %12s\n", "ci", "deep/call",
+         "wide/call", "coroutine", "reallocs");
+  for (int mode = 0; mode <= NMODES; mode++) {
+    int usehint = mode == NMODES; /* last row: pool with hints */
+    int m = usehint ? M_POOL : mode;
+    State *L = newthread(m, KMAIN, 0);
+    int rounds = 20;
+
+    double start = now();
+    for (int r = 0; r < rounds; r++) {
+      if (deep(L, depth, 8) != deep_result(depth, 8)) {
+        error("deep");
+      }
+    }
+    double tdeep = (now() - start) / rounds / (depth + 1);
+
+    start = now();
+    if (wide(L, levels, 2, 4) != wide_calls) {
+      error("wide");
+    }
+    double twide = (now() - start) / wide_calls;
+    freethread(L);
+
+    /* the hints come from the coroutines of the 'pool' row */
+    if (!usehint) {
+      memset(hints, 0, sizeof(hints));
+    }
+    int nrealloc = 0;
+    start = now();
+    for (int i = 0; i < ncoro; i++) {
+      int kind = i % NKINDS;
+      State *co = newthread(m, kind, usehint);
+      if (deep(co, kinddepth[kind], COFRAME) !=
+          deep_result(kinddepth[kind], COFRAME)) {
+        error("coroutine");
+      }
+      nrealloc += co->nrealloc;
+      freethread(co);
+    }
+    double tco = (now() - start) / ncoro;
+
+    printf("%-10s | %9.2f ns | %9.2f ns | %9.2f ns | %12d\n",
+           usehint ? "pool+hint" : modename[mode], tdeep * 1e9, twide * 1e9,
+           tco * 1e9, nrealloc);
+  }
+
+  printf("\n%-6s | %8s | %8s | %14s | %12s\n", "kind", "threads", "depth",
+         "hwm ci", "hwm stack");
+  for (int k = 0; k < NKINDS; k++) {
+    printf("%-6d | %8d | %8d | %14d | %12d\n", k, hints[k].threads,
+           kinddepth[k], hints[k].ci, hints[k].stack);
+  }
+  printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+  printf("sizeof(CallInfo): %zu, sizeof(TValue): %zu\n", sizeof(CallInfo),
+         sizeof(TValue));
+  test_modes();
+  int depth = argc > 1 ? atoi(argv[1]) : 10000;
+  bench(depth, 20, 100000);
+  return 0;
+}
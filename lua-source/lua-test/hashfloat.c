@@ -0,0 +1,359 @@
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* inspired by l_hashfloat in ltable.c and luaV_flttointeger in lvm.c */
+
+/*
+ * see hashfloat.md for the reference version. the variants here compute the
+ * same value straight from the IEEE-754 bits:
+ *
+ * for a normal 'n = (-1)^s * 1.f * 2^(e - 1023)', frexp gives
+ * 'm = (-1)^s * 1.f / 2' and 'i = e - 1022', so 'm * -INT_MIN' is
+ * '(-1)^s * (2^52 | f) / 2^22', whose truncation is '(2^52 | f) >> 22'
+ * with the sign applied. subnormals are first normalized so that their
+ * highest bit is at position 52; inf/NaN (e == 2047) hash to 0.
+ *
+ * build with -O3 (and -march=native) to let the batch loop vectorize.
+ */
+
+#define cast(t, exp) ((t)(exp))
+#define cast_num(i) cast(double, (i))
+#define cast_int(i) cast(int, (i))
+#define cast_uint(i) cast(unsigned int, (i))
+
+#define l_unlikely(x) __builtin_expect((x) != 0, 0)
+
+#define lua_numbertointeger(n, p)                                              \
+  ((n) >= cast_num(INT64_MIN) && (n) < -cast_num(INT64_MIN) &&                 \
+   (*(p) = cast(int64_t, n), 1))
+
+#define FRACBITS 52
+#define FRACMASK ((UINT64_C(1) << FRACBITS) - 1)
+#define EXPMASK 0x7FF
+
+/* reference */
+
+int l_hashfloat(double n) {
+  int i;
+  int64_t ni;
+  n = frexp(n, &i) * -cast_num(INT_MIN);
+  if (!lua_numbertointeger(n, &ni)) { /* is 'n' inf/-inf/NaN? */
+    return 0;
+  } else { /* normal case */
+    unsigned int u = cast_uint(i) + cast_uint(ni);
+    return cast_int(u <= cast_uint(INT_MAX) ? u : ~u);
+  }
+}
+
+/* luaV_flttointeger(n, p, F2Ieq) */
+int flttointeger(double n, int64_t *p) {
+  double f = floor(n);
+  if (n != f) {
+    return 0;
+  }
+  return lua_numbertointeger(f, p);
+}
+
+/* bit manipulation */
+
+static inline uint64_t float2bits(double n) {
+  uint64_t b;
+  memcpy(&b, &n, sizeof(b));
+  return b;
+}
+
+/* hash of a normal, inf or NaN whose bits are 'b' (wrong for 0/subnormals) */
+static inline int hashnormal(uint64_t b) {
+  int e = cast_int((b >> FRACBITS) & EXPMASK);
+  int64_t ni = cast(int64_t, ((b & FRACMASK) | (FRACMASK + 1)) >> 22);
+  int64_t sign = -cast(int64_t, b >> 63); /* 0 or -1 */
+  unsigned int u = cast_uint(e - 1022) + cast_uint((ni ^ sign) - sign);
+  unsigned int r = u ^ cast_uint(cast_int(u) >> 31); /* u or ~u */
+  return cast_int(r & -cast_uint(e != EXPMASK));      /* 0 for inf/NaN */
+}
+
+/* zero and subnormals: normalize the fraction, then as 'hashnormal' */
+static int hashsubnormal(uint64_t b) {
+  uint64_t f = b & FRACMASK;
+  if (f == 0) {
+    return 0; /* frexp(0) is 0 * 2^0 */
+  }
+  int shift = __builtin_clzll(f) - (63 - FRACBITS);
+  int64_t ni = cast(int64_t, (f << shift) >> 22);
+  if (b >> 63) {
+    ni = -ni;
+  }
+  unsigned int u = cast_uint(1 - shift - 1022) + cast_uint(ni);
+  return cast_int(u <= cast_uint(INT_MAX) ? u : ~u);
+}
+
+int hashfloat(double n) {
+  uint64_t b = float2bits(n);
+  if (l_unlikely(((b >> FRACBITS) & EXPMASK) == 0)) {
+    return hashsubnormal(b);
+  }
+  return hashnormal(b);
+}
+
+/*
+ * batch version: a branch free pass over everything, then a fix-up pass for
+ * the (rare) zeros and subnormals
+ */
+void hashfloat_batch(const double *in, int *out, size_t n) {
+  int fixup = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint64_t b = float2bits(in[i]);
+    out[i] = hashnormal(b);
+    fixup |= ((b >> FRACBITS) & EXPMASK) == 0;
+  }
+  if (l_unlikely(fixup)) {
+    for (size_t i = 0; i < n; i++) {
+      uint64_t b = float2bits(in[i]);
+      if (((b >> FRACBITS) & EXPMASK) == 0) {
+        out[i] = hashsubnormal(b);
+      }
+    }
+  }
+}
+
+/*
+ * float key normalization without 'floor': convert when the value is inside
+ * the range of integers (-2^63 is, 2^63 is not; NaN fails both tests) and
+ * check that converting back gives the same float
+ */
+static inline int flttointeger_fast(double n, int64_t *p) {
+  if (n >= -0x1p63 && n < 0x1p63) {
+    int64_t i = cast(int64_t, n);
+    if (cast_num(i) == n) {
+      *p = i;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * 'flttointeger_fast' from the bits: a float is an integer in range when its
+ * exponent 'e - 1023' is in [0, 62] and no fraction bit is left below the
+ * binary point, or when it is zero or -2^63. only shifts, masks and selects,
+ * so the loop below can be vectorized
+ */
+static inline int bits2integer(uint64_t b, int64_t *p) {
+  int e = cast_int((b >> FRACBITS) & EXPMASK);
+  uint64_t m = (b & FRACMASK) | (FRACMASK + 1);
+  int rs = 1075 - e; /* number of fraction bits below the binary point */
+  unsigned int rsc = cast_uint(rs > 0 ? rs : 0) & 63;
+  unsigned int lsc = cast_uint(rs < 0 ? -rs : 0) & 63;
+  uint64_t mag = (m >> rsc) << lsc;
+  uint64_t sign = -(b >> 63);
+  int exact = ((m >> rsc) << rsc) == m;
+  int inrange = (e >= 1023) & (e <= 1085);
+  int zero = (b << 1) == 0;
+  int minint = b == 0xC3E0000000000000ULL; /* -2^63 */
+  int64_t k = cast(int64_t, (mag ^ sign) - sign);
+  *p = zero ? 0 : minint ? INT64_MIN : k;
+  return (inrange & exact) | zero | minint;
+}
+
+/*
+ * what a table does with a float key before hashing: integral floats become
+ * integer keys (hashed by their value, like 'hashint'), other floats go
+ * through 'l_hashfloat'. 'isint[i]' tells which one 'h[i]' is.
+ *
+ * both results are computed and one is selected, so a mix of integral and
+ * non-integral keys costs no mispredicted branches. zeros are integral, so
+ * only non-integral subnormals need the fix-up pass.
+ */
+void hashkey_batch(const double *in, uint64_t *h, unsigned char *isint,
+                   size_t n) {
+  int fixup = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint64_t b = float2bits(in[i]);
+    int64_t k;
+    int integral = bits2integer(b, &k);
+    uint64_t hf = cast_uint(hashnormal(b));
+    h[i] = integral ? cast(uint64_t, k) : hf;
+    isint[i] = cast(unsigned char, integral);
+    fixup |= !integral & (((b >> FRACBITS) & EXPMASK) == 0);
+  }
+  if (l_unlikely(fixup)) {
+    for (size_t i = 0; i < n; i++) {
+      uint64_t b = float2bits(in[i]);
+      if (!isint[i] && ((b >> FRACBITS) & EXPMASK) == 0) {
+        h[i] = cast_uint(hashsubnormal(b));
+      }
+    }
+  }
+}
+
+/* tests */
+
+static int failures = 0;
+
+static void test_value(double n) {
+  int ref = l_hashfloat(n);
+  int fast = hashfloat(n);
+  int batch;
+  hashfloat_batch(&n, &batch, 1);
+  int64_t ik = 0, fk = 0;
+  int ir = flttointeger(n, &ik);
+  int fr = flttointeger_fast(n, &fk);
+  int64_t bk = 0;
+  if (bits2integer(float2bits(n), &bk) != fr || (fr && bk != fk)) {
+    fr = -1;
+  }
+  uint64_t h;
+  unsigned char isint;
+  hashkey_batch(&n, &h, &isint, 1);
+  if (isint ? h != cast(uint64_t, fk) : h != cast_uint(ref)) {
+    fr = -1;
+  }
+  if (ref != fast || ref != batch || ir != fr || isint != fr || ik != fk) {
+    printf("Failed: %a (bits %016llx): hash %d/%d/%d, int %d:%lld/%d:%lld\n",
+           n, cast(unsigned long long, float2bits(n)), ref, fast, batch, ir,
+           cast(long long, ik), fr, cast(long long, fk));
+    failures++;
+  }
+}
+
+static double bits2float(uint64_t b) {
+  double n;
+  memcpy(&n, &b, sizeof(n));
+  return n;
+}
+
+static uint64_t rnd = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t xorshift() {
+  rnd ^= rnd << 13;
+  rnd ^= rnd >> 7;
+  rnd ^= rnd << 17;
+  return rnd;
+}
+
+static void test_hashfloat() {
+  const double special[] = {
+      0.0, -0.0, INFINITY, -INFINITY, NAN, -NAN, 0.5, -0.5, 1.0, -1.0,
+      DBL_MIN, -DBL_MIN, DBL_TRUE_MIN, -DBL_TRUE_MIN, DBL_MIN - DBL_TRUE_MIN,
+      DBL_MAX, -DBL_MAX, DBL_EPSILON, 1.0 - DBL_EPSILON / 2,
+      0x1p31, -0x1p31, 0x1p31 - 1, -0x1p31 + 1, 0x1p32, 0x1p53, 0x1p53 + 2,
+      0x1p53 - 1, 0x1p63, -0x1p63, 0x1p63 - 1024, -0x1p63 - 2048, 0x1p64,
+      0.1, -0.1, 3.14159, 1e300, -1e-300, 4.9e-324 * 3};
+  for (size_t i = 0; i < sizeof(special) / sizeof(special[0]); i++) {
+    test_value(special[i]);
+  }
+  /* NaN payloads, both signs */
+  test_value(bits2float(0x7FF0000000000001ULL));
+  test_value(bits2float(0xFFF8000000000123ULL));
+  /* every exponent, with edge fractions */
+  for (uint64_t e = 0; e <= EXPMASK; e++) {
+    for (int s = 0; s < 2; s++) {
+      uint64_t hi = (cast(uint64_t, s) << 63) | (e << FRACBITS);
+      test_value(bits2float(hi));
+      test_value(bits2float(hi | 1));
+      test_value(bits2float(hi | FRACMASK));
+      test_value(bits2float(hi | (UINT64_C(1) << 21)));
+      test_value(bits2float(hi | (UINT64_C(1) << 22)));
+    }
+  }
+  /* random bit patterns */
+  for (int i = 0; i < 1000000; i++) {
+    test_value(bits2float(xorshift()));
+  }
+  /* integers around the limits of the conversion */
+  for (int64_t i = -1000; i <= 1000; i++) {
+    test_value(cast_num(i));
+    test_value(cast_num(i) + 0.25);
+  }
+  printf(failures == 0 ? "Passed\n" : "Failed\n");
+}
+
+/* benchmark */
+
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast_num(ts.tv_sec) + cast_num(ts.tv_nsec) * 1e-9;
+}
+
+#define BENCH(name, n, body)                                                   \
+  do {                                                                         \
+    double start_ = now();                                                     \
+    body;                                                                      \
+    printf("%-24s %8.3f ns/key\n", name, (now() - start_) * 1e9 / (n));        \
+  } while (0)
+
+static void bench(size_t n, int percent_int) {
+  double *keys = (double *)malloc(n * sizeof(double));
+  int *out = (int *)malloc(n * sizeof(int));
+  uint64_t *h = (uint64_t *)malloc(n * sizeof(uint64_t));
+  unsigned char *isint = (unsigned char *)malloc(n);
+  for (size_t i = 0; i < n; i++) {
+    if (cast_int(xorshift() % 100) < percent_int) {
+      keys[i] = cast_num(cast(int64_t, xorshift() % 1000000));
+    } else {
+      keys[i] = cast_num(xorshift() >> 11) * 0x1p-33; /* [0, 2^20) */
+    }
+  }
+  int *ref = (int *)malloc(n * sizeof(int));
+  uint64_t *href = (uint64_t *)malloc(n * sizeof(uint64_t));
+  /* touch the outputs so page faults are not timed */
+  memset(out, 0, n * sizeof(int));
+  memset(ref, 0, n * sizeof(int));
+  memset(h, 0, n * sizeof(uint64_t));
+  memset(href, 0, n * sizeof(uint64_t));
+  memset(isint, 0, n);
+  printf("%zu keys, %d%% integral\n", n, percent_int);
+
+  BENCH("l_hashfloat", n, {
+    for (size_t i = 0; i < n; i++) {
+      ref[i] = l_hashfloat(keys[i]);
+    }
+  });
+  BENCH("hashfloat", n, {
+    for (size_t i = 0; i < n; i++) {
+      out[i] = hashfloat(keys[i]);
+    }
+  });
+  if (memcmp(ref, out, n * sizeof(int)) != 0) {
+    printf("Failed: hashfloat differs\n");
+  }
+  BENCH("hashfloat_batch", n, hashfloat_batch(keys, out, n));
+  if (memcmp(ref, out, n * sizeof(int)) != 0) {
+    printf("Failed: hashfloat_batch differs\n");
+  }
+
+  BENCH("flttointeger + hash", n, {
+    for (size_t i = 0; i < n; i++) {
+      int64_t k;
+      href[i] = flttointeger(keys[i], &k) ? cast(uint64_t, k)
+                                          : cast_uint(l_hashfloat(keys[i]));
+    }
+  });
+  BENCH("hashkey_batch", n, hashkey_batch(keys, h, isint, n));
+  if (memcmp(href, h, n * sizeof(uint64_t)) != 0) {
+    printf("Failed: hashkey_batch differs\n");
+  }
+  printf("\n");
+
+  free(href);
+  free(ref);
+  free(isint);
+  free(h);
+  free(out);
+  free(keys);
+}
+
+int main() {
+  test_hashfloat();
+  bench(1u << 22, 0);
+  bench(1u << 22, 50);
+  return failures != 0;
+}
@@ -6,6 +6,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 /* inspired by lstring.h and lstring.c */
 
@@ -22,6 +23,8 @@
   (cast2s(n) < MAX_SIZE / sizeof(t) ? n : MAX_SIZE / sizeof(t))
 
 #define MAXSHRLEN 48
+/* long strings hash at most about 2^HASHLIMIT sampled chars */
+#define HASHLIMIT 5
 #define MAXSTRTAB limit(MAX_SIZE, String *)
 
 #define INTERNAL_API static
@@ -29,10 +32,18 @@
 
 typedef unsigned char byte;
 
+#define SHRSTR 0 /* interned, hashed at creation */
+#define LNGSTR 1 /* not interned, hashed on first use as a key */
+
 typedef struct String {
-  byte shrlen;
-  uint32_t hash;        /* hash value for this string */
-  struct String *hnext; /* for hash table */
+  byte tt;
+  byte extra;  /* long strings: whether 'hash' has been computed */
+  byte shrlen; /* length for short strings */
+  uint32_t hash; /* hash value for this string */
+  union {
+    size_t lnglen;        /* length for long strings */
+    struct String *hnext; /* for hash table */
+  } u;
   char contents[1];
 } String;
 
@@ -43,9 +54,13 @@ typedef struct StringTable {
 } StringTable;
 
 #define check_exp(cond, exp) (assert(cond), exp)
-#define isshrstr(s) (s->shrlen <= MAXSHRLEN)
+#define isshrstr(s) ((s)->tt == SHRSTR)
+#define islngstr(s) ((s)->tt == LNGSTR)
+#define tsslen(s) (isshrstr(s) ? cast2s((s)->shrlen) : (s)->u.lnglen)
 
-#define getstr(s) check_exp(isshrstr(s), s->contents)
+#define getshrstr(s) check_exp(isshrstr(s), (s)->contents)
+#define getlngstr(s) check_exp(islngstr(s), (s)->contents)
+#define getstr(s) ((s)->contents)
 #define stringsize(clen)                                                       \
   (offsetof(String, contents) + (clen + 1) * sizeof(char))
 
@@ -54,13 +69,15 @@ typedef struct StringTable {
   check_exp((size & (size - 1)) == 0, cast2ui(hash & (size - 1)))
 
 #define createstrobj(str, slen, allen, s)                                      \
-  (s = (String *)malloc(allen), s->shrlen = slen, s->hnext = NULL,             \
-   s->hash = stringhash(str, slen, seed), memcpy(s->contents, str, slen))
+  (s = (String *)malloc(allen), s->tt = SHRSTR, s->extra = 0,                  \
+   s->shrlen = slen, s->u.hnext = NULL,                                        \
+   s->hash = stringhash(str, slen, seed), memcpy(s->contents, str, slen),      \
+   s->contents[slen] = '\0')
 
 /* interface */
 
 /* for string */
-INTERNAL_API uint32_t stringhash(const char *str, byte l, uint32_t seed) {
+INTERNAL_API uint32_t stringhash(const char *str, size_t l, uint32_t seed) {
   uint32_t hash = seed ^ cast2ui(l);
   for (; l > 0; l--) {
     hash ^= ((hash << 5) + (hash >> 2) + cast2ui(str[l - 1]));
@@ -68,6 +85,21 @@ INTERNAL_API uint32_t stringhash(const char *str, byte l, uint32_t seed) {
   return hash;
 }
 
+/*
+ * same mixing as 'stringhash', but only every 'step' chars are used so that a
+ * string of any length costs at most about 2^HASHLIMIT steps (luaS_hash in
+ * Lua 5.3). strings differing only in skipped chars collide and are told
+ * apart by 'eqlngstr'
+ */
+INTERNAL_API uint32_t samplehash(const char *str, size_t l, uint32_t seed) {
+  uint32_t hash = seed ^ cast2ui(l);
+  size_t step = (l >> HASHLIMIT) + 1;
+  for (; l >= step; l -= step) {
+    hash ^= ((hash << 5) + (hash >> 2) + cast2ui(str[l - 1]));
+  }
+  return hash;
+}
+
 /* for string table */
 INTERNAL_API void tablerehash(String **vect, size_t old, size_t new) {
   for (size_t i = old; i < new; i++) {
@@ -78,37 +110,38 @@ INTERNAL_API void tablerehash(String **vect, size_t old, size_t new) {
     String *p = vect[i];
     vect[i] = NULL; /* reset this slot */
     while (p) {
-      String *nxt = p->hnext; /* save the next item */
+      String *nxt = p->u.hnext; /* save the next item */
       uint32_t slot = hmod(p->hash, new);
-      p->hnext = vect[slot];
+      p->u.hnext = vect[slot];
       vect[slot] = p;
       p = nxt;
     }
   }
 }
 
-INTERNAL_API int growstrtable(StringTable *st) {
-  assert(cast2s(st->size * 2) <= MAXSTRTAB);
-  String **nvec = (String **)realloc(st->hash, st->size * 2);
-  if (nvec) {
-    st->hash = nvec;
-    return 1;
-  }
-  return 0;
-}
-
 INTERNAL_API void resizetable(StringTable *st, size_t new) {
   if (new < st->size) {
     tablerehash(st->hash, st->size, new);
+    st->hash = (String **)realloc(st->hash, new * sizeof(String *));
+    st->size = new;
   } else if (new > st->size) {
-    growstrtable(st);
-    tablerehash(st->hash, st->size, new);
+    String **nvec = (String **)realloc(st->hash, new * sizeof(String *));
+    if (nvec) { /* keep the old table if allocation fails */
+      st->hash = nvec;
+      tablerehash(st->hash, st->size, new);
+      st->size = new;
+    }
   }
 }
 
+INTERNAL_API void growstrtable(StringTable *st) {
+  assert(cast2s(st->size * 2) <= MAXSTRTAB);
+  resizetable(st, st->size * 2);
+}
+
 INTERNAL_API void insertstr(StringTable *st, String *s) {
   uint32_t slot = hmod(s->hash, st->size);
-  s->hnext = st->hash[slot];
+  s->u.hnext = st->hash[slot];
   st->hash[slot] = s;
   st->nuse++;
 }
@@ -117,9 +150,10 @@ INTERNAL_API void removestr(StringTable *st, String *s) {
   uint32_t slot = hmod(s->hash, st->size);
   String **p = &st->hash[slot];
   while (*p != s) {
-    *p = (*p)->hnext;
+    p = &(*p)->u.hnext;
   }
-  *p = (*p)->hnext;
+  *p = (*p)->u.hnext;
+  st->nuse--;
   free(s); /* free string */
 }
 
@@ -127,7 +161,7 @@ EXTERNAL_API StringTable *initstrtable() {
   StringTable *st = (StringTable *)malloc(sizeof(StringTable));
   st->size = (1 << 4); /* initial size of 16 */
   st->nuse = 0;
-  st->hash = (String **)malloc(sizeof(String *) * st->size);
+  st->hash = (String **)calloc(st->size, sizeof(String *));
   return st;
 }
 
@@ -139,14 +173,13 @@ INTERNAL_API String *internstring(StringTable *st, const char *str, byte slen,
   uint32_t slot = hmod(hash, st->size);
   String **list = &st->hash[slot]; /* locate all string placed in this slot */
   for (String *p = *list; p;
-       p = p->hnext) { /* hash must identical in this slot */
-    char *c1 = getstr(p);
+       p = p->u.hnext) { /* hash must identical in this slot */
     if (p->shrlen == slen &&
-        (memcmp(getstr(p), str, slen * sizeof(char)) == 0)) {
+        (memcmp(getshrstr(p), str, slen * sizeof(char)) == 0)) {
       return p; /* reuse string */
     }
   }
-  if (++st->nuse >= st->size) { /* need to grow table ? */
+  if (st->nuse >= st->size) { /* need to grow table ? */
     growstrtable(st);
   }
   /* create new string */
@@ -156,18 +189,221 @@ INTERNAL_API String *internstring(StringTable *st, const char *str, byte slen,
   return s;
 }
 
-EXTERNAL_API String *createstr(StringTable *st, const char *str, byte slen) {
-  assert(slen <= MAXSHRLEN);
-  uint32_t seed = 0xAAAB;
-  return internstring(st, str, slen, seed);
+#define SEED 0xAAAB
+
+/* long strings are neither interned nor hashed here */
+EXTERNAL_API String *createlngstr(const char *str, size_t l) {
+  String *s = (String *)malloc(stringsize(l));
+  s->tt = LNGSTR;
+  s->extra = 0;
+  s->shrlen = 0;
+  s->hash = 0;
+  s->u.lnglen = l;
+  memcpy(s->contents, str, l);
+  s->contents[l] = '\0';
+  return s;
+}
+
+EXTERNAL_API String *createstr(StringTable *st, const char *str, size_t l) {
+  if (l <= MAXSHRLEN) {
+    return internstring(st, str, cast(byte, l), SEED);
+  }
+  return createlngstr(str, l);
+}
+
+/* hash of a long string, computed the first time it is needed */
+EXTERNAL_API uint32_t hashlngstr(String *s) {
+  assert(islngstr(s));
+  if (s->extra == 0) {
+    s->hash = samplehash(getlngstr(s), s->u.lnglen, SEED);
+    s->extra = 1;
+  }
+  return s->hash;
+}
+
+EXTERNAL_API uint32_t hashstr(String *s) {
+  return isshrstr(s) ? s->hash : hashlngstr(s);
 }
 
 /* create literal string */
 #define createltrstr(st, str) createstr(st, str, sizeof(str) / sizeof(char))
 
-EXTERNAL_API void releasestr(StringTable *st, String *s) { removestr(st, s); }
+EXTERNAL_API void releasestr(StringTable *st, String *s) {
+  if (isshrstr(s)) {
+    removestr(st, s);
+  } else {
+    free(s);
+  }
+}
 
-#define eqstring(l, r) (l == r)
+/* length first, then cached hashes (when both exist), then contents */
+EXTERNAL_API int eqlngstr(const String *a, const String *b) {
+  size_t len = a->u.lnglen;
+  assert(islngstr(a) && islngstr(b));
+  return (a == b) ||
+         ((len == b->u.lnglen) &&
+          !(a->extra && b->extra && a->hash != b->hash) &&
+          (memcmp(getlngstr(a), getlngstr(b), len) == 0));
+}
+
+/* short strings are interned, so they are equal iff they are the same */
+#define eqshrstr(l, r) check_exp(isshrstr(l) && isshrstr(r), (l) == (r))
+#define eqstring(l, r)                                                         \
+  ((l)->tt == (r)->tt && (isshrstr(l) ? eqshrstr(l, r) : eqlngstr(l, r)))
+
+/* a minimal table keyed by strings, to use long strings as keys */
+
+typedef struct StringMap {
+  String **key;
+  int *val;
+  uint32_t size; /* power of 2, never full */
+} StringMap;
+
+INTERNAL_API StringMap *newmap(uint32_t n) {
+  StringMap *m = (StringMap *)malloc(sizeof(StringMap));
+  m->size = 1;
+  while (m->size < n * 2) {
+    m->size <<= 1;
+  }
+  m->key = (String **)calloc(m->size, sizeof(String *));
+  m->val = (int *)calloc(m->size, sizeof(int));
+  return m;
+}
+
+INTERNAL_API void freemap(StringMap *m) {
+  free(m->key);
+  free(m->val);
+  free(m);
+}
+
+INTERNAL_API uint32_t mapslot(StringMap *m, String *s) {
+  uint32_t slot = hmod(hashstr(s), m->size);
+  while (m->key[slot] && !eqstring(m->key[slot], s)) {
+    slot = hmod((slot + 1), m->size);
+  }
+  return slot;
+}
+
+INTERNAL_API void mapset(StringMap *m, String *s, int v) {
+  uint32_t slot = mapslot(m, s);
+  m->key[slot] = s;
+  m->val[slot] = v;
+}
+
+INTERNAL_API int *mapget(StringMap *m, String *s) {
+  uint32_t slot = mapslot(m, s);
+  return m->key[slot] ? &m->val[slot] : NULL;
+}
+
+/* old behaviour applied to long strings: every char hashed at creation */
+INTERNAL_API String *createeager(const char *str, size_t l) {
+  String *s = createlngstr(str, l);
+  s->hash = stringhash(str, l, SEED);
+  s->extra = 1;
+  return s;
+}
+
+INTERNAL_API double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+INTERNAL_API void test_lngstr(StringTable *st) {
+  char buf[1024];
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    buf[i] = (char)('a' + i % 26);
+  }
+  String *a = createstr(st, buf, sizeof(buf));
+  String *b = createstr(st, buf, sizeof(buf));
+  String *c = createstr(st, buf, sizeof(buf) - 1);
+  buf[1] = '#'; /* not sampled: step is (1024 >> 5) + 1 = 33 */
+  String *d = createstr(st, buf, sizeof(buf));
+
+  assert(islngstr(a) && a != b); /* not interned */
+  assert(a->extra == 0);         /* not hashed yet */
+  assert(eqstring(a, b));
+  assert(!eqstring(a, c)); /* length differs */
+  assert(hashstr(a) == hashstr(d) && !eqstring(a, d));
+  assert(a->extra == 1 && hashstr(a) == hashstr(b));
+
+  StringMap *m = newmap(4);
+  mapset(m, a, 1);
+  mapset(m, d, 2);
+  assert(*mapget(m, b) == 1);
+  assert(*mapget(m, d) == 2);
+  assert(mapget(m, c) == NULL);
+  freemap(m);
+
+  releasestr(st, a);
+  releasestr(st, b);
+  releasestr(st, c);
+  releasestr(st, d);
+  printf("long string: passed\n");
+}
+
+INTERNAL_API void bench_lngstr(size_t len) {
+  size_t n = (16u << 20) / len;
+  n = n > 4096 ? 4096 : n < 16 ? 16 : n;
+  char *buf = (char *)malloc(n * len);
+  for (size_t i = 0; i < n * len; i++) {
+    buf[i] = (char)rand();
+  }
+  String **lazy = (String **)malloc(n * sizeof(String *));
+  String **eager = (String **)malloc(n * sizeof(String *));
+  String **copy = (String **)malloc(n * sizeof(String *));
+  StringMap *m = newmap(n);
+
+  double start = now();
+  for (size_t i = 0; i < n; i++) {
+    lazy[i] = createlngstr(buf + i * len, len);
+  }
+  double tlazy = now() - start;
+
+  start = now();
+  for (size_t i = 0; i < n; i++) {
+    eager[i] = createeager(buf + i * len, len);
+  }
+  double teager = now() - start;
+
+  start = now(); /* first use as a key computes the hash */
+  for (size_t i = 0; i < n; i++) {
+    mapset(m, lazy[i], (int)i);
+  }
+  double tfirst = now() - start;
+
+  start = now(); /* same objects, hash already cached */
+  int sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum += *mapget(m, lazy[i]);
+  }
+  double tcached = now() - start;
+
+  for (size_t i = 0; i < n; i++) {
+    copy[i] = createlngstr(buf + i * len, len);
+  }
+  start = now(); /* equal but distinct objects: hash + full compare */
+  for (size_t i = 0; i < n; i++) {
+    sum += *mapget(m, copy[i]);
+  }
+  double tcopy = now() - start;
+  assert(sum == (int)(n * (n - 1)));
+
+  printf("%-8zu | %10.1f ns | %10.1f ns | %10.1f ns | %10.1f ns | %10.1f ns\n",
+         len, tlazy * 1e9 / n, teager * 1e9 / n, tfirst * 1e9 / n,
+         tcached * 1e9 / n, tcopy * 1e9 / n);
+
+  for (size_t i = 0; i < n; i++) {
+    free(lazy[i]);
+    free(eager[i]);
+    free(copy[i]);
+  }
+  freemap(m);
+  free(copy);
+  free(eager);
+  free(lazy);
+  free(buf);
+}
 
 int main() {
   StringTable *st = initstrtable();
@@ -180,5 +416,13 @@ int main() {
   assert(eqstring(s1, s3));
   assert(eqstring(s2, s4));
 
+  test_lngstr(st);
+
+  printf("%-8s | %13s | %13s | %13s | %13s | %13s\n", "length", "create",
+         "create+hash", "first key", "cached key", "equal copy");
+  for (size_t len = 64; len <= (1u << 20); len *= 4) {
+    bench_lngstr(len);
+  }
+
   return 0;
 }
@@ -0,0 +1,1446 @@
+#include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* inspired by ltable.h and ltable.c */
+
+/*
+ * a standalone copy of Lua's hybrid table (array part + hash part with the
+ * 24 bytes 'Node' and chained scatter through int 'next' offsets), plus two
+ * open addressing variants of the hash part that share the same array part
+ * and 'computesizes' policy:
+ *
+ * - ref:   Lua's design, main position + 'lastfree' free position pointer
+ * - robin: linear probing with Robin Hood displacement
+ * - swiss: groups of 16 metadata bytes (7 bits of hash each) compared with
+ *          SSE2, scalar fallback otherwise
+ *
+ * the ref engine also comes with a border hint ('refhint_*'), compared to
+ * 'luaH_getn's binary search, see 'length operator' below.
+ *
+ * keys are integers, floats and (interned) short strings. there is no GC,
+ * no metatables and no 'alimit' hint: 'asize' is always the real size of the
+ * array part.
+ */
+
+/* type definition */
+
+#define cast(t, v) ((t)(v))
+#define cast_int(v) cast(int, v)
+#define cast_uint(v) cast(unsigned int, v)
+#define cast_num(v) cast(double, v)
+#define l_castS2U(i) cast(uint64_t, i)
+
+#define INTERNAL_API static
+#define EXTERNAL_API extern
+
+typedef unsigned char byte;
+
+typedef struct String {
+  uint32_t hash;
+  size_t len;
+  char contents[1];
+} String;
+
+typedef union Value {
+  int64_t i;
+  double n;
+  String *s;
+} Value;
+
+/* tags; the low 4 bits are the basic type, like 'makevariant' in lobject.h */
+#define T_NIL 0
+#define T_INT 1
+#define T_FLT 2
+#define T_STR 3
+#define T_ABSTKEY (T_NIL | (1 << 4)) /* empty slot returned for absent keys */
+
+typedef struct TValue {
+  Value value_;
+  byte tt_;
+} TValue;
+
+#define isempty(v) (((v)->tt_ & 0x0F) == T_NIL)
+#define isabstkey(v) ((v)->tt_ == T_ABSTKEY)
+#define setempty(v) ((v)->tt_ = T_NIL)
+
+/* copy value and tag only, 'o1' may be the value part of a node */
+#define setobj(o1, o2) ((o1)->value_ = (o2)->value_, (o1)->tt_ = (o2)->tt_)
+
+static const TValue absentkey = {{0}, T_ABSTKEY};
+
+#define MAXABITS cast_int(sizeof(int) * CHAR_BIT - 1)
+#define MAXASIZE (1u << MAXABITS)
+#define MAXHBITS (MAXABITS - 1)
+
+#define twoto(x) (1u << (x))
+
+/* auxiliary function */
+
+INTERNAL_API void error(const char *msg) {
+  fprintf(stderr, "error: %s\n", msg);
+  exit(EXIT_FAILURE);
+}
+
+INTERNAL_API int ceillog2(unsigned int x) {
+  int l = 0;
+  x--;
+  while (x) {
+    l++;
+    x >>= 1;
+  }
+  return l;
+}
+
+/* lua_numbertointeger */
+#define numbertointeger(n, p)                                                  \
+  ((n) >= cast_num(INT64_MIN) && (n) < -cast_num(INT64_MIN) &&                 \
+   (*(p) = cast(int64_t, n), 1))
+
+/* luaV_flttointeger with mode F2Ieq: only floats with an integral value */
+INTERNAL_API int flttointeger(double n, int64_t *p) {
+  double f = floor(n);
+  if (n != f) {
+    return 0;
+  }
+  return numbertointeger(f, p);
+}
+
+/* see hashfloat.md */
+INTERNAL_API int l_hashfloat(double n) {
+  int i;
+  int64_t ni;
+  n = frexp(n, &i) * -cast_num(INT_MIN);
+  if (!numbertointeger(n, &ni)) { /* is 'n' inf/-inf/NaN? */
+    return 0;
+  } else {
+    unsigned int u = cast_uint(i) + cast_uint(ni);
+    return cast_int(u <= cast_uint(INT_MAX) ? u : ~u);
+  }
+}
+
+/*
+ * floats with integral values are stored as integers, so 't[1.0]' and 't[1]'
+ * are the same slot; NaN can not be a key
+ */
+INTERNAL_API const TValue *normkey(const TValue *key, TValue *aux) {
+  if (key->tt_ == T_FLT) {
+    int64_t k;
+    if (flttointeger(key->value_.n, &k)) {
+      aux->value_.i = k;
+      aux->tt_ = T_INT;
+      return aux;
+    } else if (isnan(key->value_.n)) {
+      error("table index is NaN");
+    }
+  } else if (key->tt_ == T_NIL) {
+    error("table index is nil");
+  }
+  return key;
+}
+
+/* array part, shared by all engines */
+
+INTERNAL_API unsigned int arrayindex(int64_t k) {
+  if (l_castS2U(k) - 1u < MAXASIZE) { /* 'k' in [1, MAXASIZE]? */
+    return cast_uint(k);
+  }
+  return 0;
+}
+
+INTERNAL_API int countint(int64_t key, unsigned int *nums) {
+  unsigned int k = arrayindex(key);
+  if (k != 0) { /* is 'key' an appropriate array index? */
+    nums[ceillog2(k)]++;
+    return 1;
+  }
+  return 0;
+}
+
+/* nums[i] = number of keys 'k' in the array part where 2^(i - 1) < k <= 2^i */
+INTERNAL_API unsigned int numusearray(const TValue *array, unsigned int asize,
+                                      unsigned int *nums) {
+  int lg;
+  unsigned int ttlg; /* 2^lg */
+  unsigned int ause = 0;
+  unsigned int i = 1;
+  for (lg = 0, ttlg = 1; lg <= MAXABITS; lg++, ttlg *= 2) {
+    unsigned int lc = 0;
+    unsigned int lim = ttlg;
+    if (lim > asize) {
+      lim = asize;
+      if (i > lim) {
+        break;
+      }
+    }
+    for (; i <= lim; i++) { /* count elements in range (2^(lg - 1), 2^lg] */
+      if (!isempty(&array[i - 1])) {
+        lc++;
+      }
+    }
+    nums[lg] += lc;
+    ause += lc;
+  }
+  return ause;
+}
+
+/* optimal size of the array part, see hashtable.md */
+INTERNAL_API unsigned int computesizes(unsigned int nums[], unsigned int *pna) {
+  int i;
+  unsigned int twotoi; /* 2^i (candidate for optimal size) */
+  unsigned int a = 0;  /* number of elements smaller than 2^i */
+  unsigned int na = 0; /* number of elements to go to array part */
+  unsigned int optimal = 0;
+  for (i = 0, twotoi = 1; twotoi > 0 && *pna > twotoi / 2;
+       i++, twotoi *= 2) {
+    a += nums[i];
+    if (a > twotoi / 2) { /* more than half elements present? */
+      optimal = twotoi;
+      na = a;
+    }
+  }
+  assert((optimal == 0 || optimal / 2 < na) && na <= optimal);
+  *pna = na;
+  return optimal;
+}
+
+/* grow or shrink the array part, new slots are empty */
+INTERNAL_API TValue *resizearray(TValue *array, unsigned int oldasize,
+                                 unsigned int newasize) {
+  TValue *newarray = NULL;
+  if (newasize > 0) {
+    newarray = (TValue *)realloc(array, newasize * sizeof(TValue));
+    if (newarray == NULL) {
+      error("not enough memory");
+    }
+    for (unsigned int i = oldasize; i < newasize; i++) {
+      setempty(&newarray[i]);
+    }
+  } else {
+    free(array);
+  }
+  return newarray;
+}
+
+/*
+ * ===================================================================
+ * ref: Lua's hash part
+ * ===================================================================
+ */
+
+typedef union Node {
+  struct NodeKey {
+    Value value_; /* fields for value */
+    byte tt_;
+    byte key_tt; /* key type */
+    int next;    /* for chaining */
+    Value key_val;
+  } u;
+  TValue i_val; /* direct access to node's value as a proper 'TValue' */
+} Node;
+
+_Static_assert(sizeof(Node) == 24, "Node should be 24 bytes on 64-bit");
+
+typedef struct Table {
+  byte lsizenode;     /* log2 of size of 'node' array */
+  unsigned int asize; /* size of 'array' array */
+  TValue *array;
+  Node *node;
+  Node *lastfree; /* any free position is before this position */
+  int64_t border; /* a border of the table, or -1 if not known */
+} Table;
+
+#define gnode(t, i) (&(t)->node[i])
+#define gval(n) (&(n)->i_val)
+#define gnext(n) ((n)->u.next)
+#define keytt(n) ((n)->u.key_tt)
+#define keyisnil(n) (keytt(n) == T_NIL)
+#define keyival(n) ((n)->u.key_val.i)
+
+#define sizenode(t) (twoto((t)->lsizenode))
+#define lmod(s, size) (cast_int((s) & ((size) - 1)))
+#define hashpow2(t, n) (gnode(t, lmod((n), sizenode(t))))
+#define hashmod(t, n) (gnode(t, ((n) % ((sizenode(t) - 1) | 1))))
+#define hashstr(t, str) hashpow2(t, (str)->hash)
+
+static Node dummynode_ = {{{0}, T_NIL, T_NIL, 0, {0}}};
+#define dummynode (&dummynode_)
+#define isdummy(t) ((t)->lastfree == NULL)
+
+INTERNAL_API Node *hashint(const Table *t, int64_t i) {
+  uint64_t ui = l_castS2U(i);
+  if (ui <= cast_uint(INT_MAX)) {
+    return hashmod(t, cast_int(ui));
+  }
+  return hashmod(t, ui);
+}
+
+INTERNAL_API Node *mainpositionTV(const Table *t, const TValue *key) {
+  switch (key->tt_) {
+  case T_INT:
+    return hashint(t, key->value_.i);
+  case T_FLT:
+    return hashmod(t, l_hashfloat(key->value_.n));
+  case T_STR:
+    return hashstr(t, key->value_.s);
+  default:
+    error("invalid key type");
+    return NULL;
+  }
+}
+
+INTERNAL_API Node *mainpositionfromnode(const Table *t, Node *nd) {
+  TValue key = {nd->u.key_val, keytt(nd)};
+  return mainpositionTV(t, &key);
+}
+
+INTERNAL_API int equalkey(const TValue *k1, const Node *n2) {
+  if (k1->tt_ != keytt(n2)) {
+    return 0;
+  }
+  switch (k1->tt_) {
+  case T_INT:
+    return k1->value_.i == n2->u.key_val.i;
+  case T_FLT:
+    return k1->value_.n == n2->u.key_val.n;
+  default: /* short strings are interned */
+    return k1->value_.s == n2->u.key_val.s;
+  }
+}
+
+INTERNAL_API void setnodevector(Table *t, unsigned int size) {
+  if (size == 0) {
+    t->node = dummynode;
+    t->lsizenode = 0;
+    t->lastfree = NULL; /* signal that it is using dummy node */
+  } else {
+    int lsize = ceillog2(size);
+    if (lsize > MAXHBITS) {
+      error("table overflow");
+    }
+    size = twoto(lsize);
+    t->node = (Node *)malloc(size * sizeof(Node));
+    if (t->node == NULL) {
+      error("not enough memory");
+    }
+    for (unsigned int i = 0; i < size; i++) {
+      Node *n = gnode(t, i);
+      gnext(n) = 0;
+      keytt(n) = T_NIL;
+      setempty(gval(n));
+    }
+    t->lsizenode = cast(byte, lsize);
+    t->lastfree = gnode(t, size); /* all positions are free */
+  }
+}
+
+INTERNAL_API void freehash(Table *t) {
+  if (!isdummy(t)) {
+    free(t->node);
+  }
+}
+
+INTERNAL_API void exchangehashpart(Table *t1, Table *t2) {
+  byte lsizenode = t1->lsizenode;
+  Node *node = t1->node;
+  Node *lastfree = t1->lastfree;
+  t1->lsizenode = t2->lsizenode;
+  t1->node = t2->node;
+  t1->lastfree = t2->lastfree;
+  t2->lsizenode = lsizenode;
+  t2->node = node;
+  t2->lastfree = lastfree;
+}
+
+INTERNAL_API Node *getfreepos(Table *t) {
+  if (!isdummy(t)) {
+    while (t->lastfree > t->node) {
+      t->lastfree--;
+      if (keyisnil(t->lastfree)) {
+        return t->lastfree;
+      }
+    }
+  }
+  return NULL; /* could not find a free place */
+}
+
+INTERNAL_API const TValue *getint(Table *t, int64_t key) {
+  if (l_castS2U(key) - 1u < t->asize) { /* 'key' in [1, t->asize]? */
+    return &t->array[key - 1];
+  }
+  Node *n = hashint(t, key);
+  for (;;) {
+    if (keytt(n) == T_INT && keyival(n) == key) {
+      return gval(n);
+    }
+    int nx = gnext(n);
+    if (nx == 0) {
+      return &absentkey;
+    }
+    n += nx;
+  }
+}
+
+INTERNAL_API const TValue *getshortstr(Table *t, String *key) {
+  Node *n = hashstr(t, key);
+  for (;;) {
+    if (keytt(n) == T_STR && n->u.key_val.s == key) {
+      return gval(n);
+    }
+    int nx = gnext(n);
+    if (nx == 0) {
+      return &absentkey;
+    }
+    n += nx;
+  }
+}
+
+INTERNAL_API const TValue *getgeneric(Table *t, const TValue *key) {
+  Node *n = mainpositionTV(t, key);
+  for (;;) {
+    if (equalkey(key, n)) {
+      return gval(n);
+    }
+    int nx = gnext(n);
+    if (nx == 0) {
+      return &absentkey;
+    }
+    n += nx;
+  }
+}
+
+EXTERNAL_API const TValue *ref_get(Table *t, const TValue *key) {
+  switch (key->tt_) {
+  case T_STR:
+    return getshortstr(t, key->value_.s);
+  case T_INT:
+    return getint(t, key->value_.i);
+  case T_NIL:
+    return &absentkey;
+  case T_FLT: {
+    int64_t k;
+    if (flttointeger(key->value_.n, &k)) { /* integral index? */
+      return getint(t, k);
+    }
+  } /* FALLTHROUGH */
+  default:
+    return getgeneric(t, key);
+  }
+}
+
+EXTERNAL_API void ref_set(Table *t, const TValue *key, const TValue *value);
+
+INTERNAL_API void setint(Table *t, int64_t key, const TValue *value) {
+  TValue k = {{.i = key}, T_INT};
+  ref_set(t, &k, value);
+}
+
+INTERNAL_API int numusehash(const Table *t, unsigned int *nums,
+                            unsigned int *pna) {
+  int totaluse = 0;
+  int ause = 0;
+  int i = sizenode(t);
+  while (i--) {
+    Node *n = &t->node[i];
+    if (!isempty(gval(n))) {
+      if (keytt(n) == T_INT) {
+        ause += countint(keyival(n), nums);
+      }
+      totaluse++;
+    }
+  }
+  *pna += ause;
+  return totaluse;
+}
+
+INTERNAL_API void reinsert(Table *ot, Table *t) {
+  int size = sizenode(ot);
+  for (int j = 0; j < size; j++) {
+    Node *old = gnode(ot, j);
+    if (!isempty(gval(old))) {
+      TValue k = {old->u.key_val, keytt(old)};
+      ref_set(t, &k, gval(old));
+    }
+  }
+}
+
+INTERNAL_API void resize(Table *t, unsigned int newasize, unsigned int nhsize) {
+  Table newt; /* to keep the new hash part */
+  unsigned int oldasize = t->asize;
+  setnodevector(&newt, nhsize);
+  if (newasize < oldasize) { /* will array shrink? */
+    t->asize = newasize;     /* pretend array has new size... */
+    exchangehashpart(t, &newt);
+    /* re-insert into the new hash the elements from vanishing slice */
+    for (unsigned int i = newasize; i < oldasize; i++) {
+      if (!isempty(&t->array[i])) {
+        setint(t, i + 1, &t->array[i]);
+      }
+    }
+    t->asize = oldasize; /* restore current size... */
+    exchangehashpart(t, &newt);
+  }
+  exchangehashpart(t, &newt); /* 't' has the new hash ('newt' has the old) */
+  t->array = resizearray(t->array, oldasize, newasize);
+  t->asize = newasize;
+  reinsert(&newt, t);
+  freehash(&newt);
+}
+
+INTERNAL_API void rehash(Table *t, const TValue *ek) {
+  unsigned int asize; /* optimal size for array part */
+  unsigned int na;    /* number of keys in the array part */
+  unsigned int nums[MAXABITS + 1];
+  int totaluse;
+  for (int i = 0; i <= MAXABITS; i++) {
+    nums[i] = 0;
+  }
+  na = numusearray(t->array, t->asize, nums);
+  totaluse = na;
+  totaluse += numusehash(t, nums, &na);
+  if (ek->tt_ == T_INT) {
+    na += countint(ek->value_.i, nums);
+  }
+  totaluse++;
+  asize = computesizes(nums, &na);
+  resize(t, asize, totaluse - na);
+}
+
+/*
+ * inserts a new key into a hash table; first, check whether key's main
+ * position is free. If not, check whether colliding node is in its main
+ * position or not: if it is not, move colliding node to an empty place and
+ * put new key in its main position; otherwise (colliding node is in its main
+ * position), new key goes to an empty position.
+ */
+INTERNAL_API void newkey(Table *t, const TValue *key, const TValue *value) {
+  Node *mp;
+  TValue aux;
+  key = normkey(key, &aux);
+  if (isempty(value)) {
+    return; /* do not insert nil values */
+  }
+  mp = mainpositionTV(t, key);
+  if (!isempty(gval(mp)) || isdummy(t)) { /* main position is taken? */
+    Node *othern;
+    Node *f = getfreepos(t);
+    if (f == NULL) { /* cannot find a free place? */
+      rehash(t, key);
+      ref_set(t, key, value);
+      return;
+    }
+    othern = mainpositionfromnode(t, mp);
+    if (othern != mp) { /* is colliding node out of its main position? */
+      while (othern + gnext(othern) != mp) { /* find previous */
+        othern += gnext(othern);
+      }
+      gnext(othern) = cast_int(f - othern); /* rechain to point to 'f' */
+      *f = *mp; /* copy colliding node into free pos. (mp->next also goes) */
+      if (gnext(mp) != 0) {
+        gnext(f) += cast_int(mp - f); /* correct 'next' */
+        gnext(mp) = 0;                /* now 'mp' is free */
+      }
+      setempty(gval(mp));
+    } else { /* colliding node is in its own main position */
+      if (gnext(mp) != 0) {
+        gnext(f) = cast_int((mp + gnext(mp)) - f); /* chain new position */
+      } else {
+        assert(gnext(f) == 0);
+      }
+      gnext(mp) = cast_int(f - mp);
+      mp = f;
+    }
+  }
+  mp->u.key_val = key->value_;
+  keytt(mp) = key->tt_;
+  setobj(gval(mp), value);
+}
+
+EXTERNAL_API void ref_set(Table *t, const TValue *key, const TValue *value) {
+  const TValue *slot = ref_get(t, key);
+  if (isabstkey(slot)) {
+    newkey(t, key, value);
+  } else {
+    setobj(cast(TValue *, slot), value);
+  }
+}
+
+/*
+ * ===================================================================
+ * length operator
+ * ===================================================================
+ */
+
+/*
+ * 'ref_getn' is 'luaH_getn' without 'alimit' (as in Lua 5.3): every call
+ * starts again from 'asize', so 't[#t + 1] = v' costs a binary search over
+ * the array part or a doubling search through the hash part.
+ *
+ * 'refhint_getn' returns 't->border' instead, a border kept up to date by
+ * 'refhint_set' ('ref_set' plus one probe) for the two common cases:
+ *
+ * - append, 't[border + 1] = v': 'border + 1' is the new border if
+ *   't[border + 2]' is absent;
+ * - removal at the end, 't[border] = nil': 'border - 1' is the new border if
+ *   't[border - 1]' is present.
+ *
+ * any other assignment keeps the old border valid ('t[border]' is still
+ * present and 't[border + 1]' still absent). when the cheap check fails the
+ * hint is dropped (-1) and the next query pays one 'ref_getn' to find it
+ * again, so appends and removals at the end are O(1) amortized.
+ *
+ * both return a valid border, but not necessarily the same one when the
+ * table has holes. a table written with 'ref_set' does not keep 't->border',
+ * so it must only be measured with 'ref_getn'.
+ */
+
+INTERNAL_API unsigned int binsearch(const TValue *array, unsigned int i,
+                                    unsigned int j) {
+  while (j - i > 1u) { /* binary search */
+    unsigned int m = (i + j) / 2;
+    if (isempty(&array[m - 1])) {
+      j = m;
+    } else {
+      i = m;
+    }
+  }
+  return i;
+}
+
+INTERNAL_API uint64_t hash_search(Table *t, uint64_t j) {
+  uint64_t i;
+  if (j == 0) {
+    j++; /* the caller ensures 'j + 1' is present */
+  }
+  do {
+    i = j; /* 'i' is a present index */
+    if (j <= l_castS2U(INT64_MAX) / 2) {
+      j *= 2;
+    } else {
+      j = INT64_MAX;
+      if (isempty(getint(t, cast(int64_t, j)))) { /* t[j] not present? */
+        break; /* 'j' now is an absent index */
+      } else {
+        return j; /* max integer is a boundary... */
+      }
+    }
+  } while (!isempty(getint(t, cast(int64_t, j)))); /* repeat until an absent */
+  /* i < j  &&  t[i] present  &&  t[j] absent */
+  while (j - i > 1u) { /* do a binary search between them */
+    uint64_t m = (i + j) / 2;
+    if (isempty(getint(t, cast(int64_t, m)))) {
+      j = m;
+    } else {
+      i = m;
+    }
+  }
+  return i;
+}
+
+EXTERNAL_API uint64_t ref_getn(Table *t) {
+  unsigned int j = t->asize;
+  if (j > 0 && isempty(&t->array[j - 1])) { /* there is a border before 'j' */
+    return binsearch(t->array, 0, j);
+  }
+  /* 'j' is zero or present in table */
+  if (isdummy(t) || isempty(getint(t, cast(int64_t, j) + 1))) {
+    return j; /* 'j + 1' is absent */
+  }
+  return hash_search(t, j);
+}
+
+EXTERNAL_API uint64_t refhint_getn(Table *t) {
+  if (t->border < 0) {
+    t->border = cast(int64_t, ref_getn(t));
+  }
+  return l_castS2U(t->border);
+}
+
+/* keep 't->border' a border after 't[key] = value' */
+INTERNAL_API void updateborder(Table *t, const TValue *key,
+                               const TValue *value) {
+  int64_t k;
+  if (t->border < 0) {
+    return;
+  }
+  if (key->tt_ == T_INT) {
+    k = key->value_.i;
+  } else if (key->tt_ != T_FLT || !flttointeger(key->value_.n, &k)) {
+    return; /* not an integer key */
+  }
+  if (isempty(value)) {
+    if (k == t->border && k > 0) { /* removal at the end */
+      t->border = (k == 1 || !isempty(getint(t, k - 1))) ? k - 1 : -1;
+    }
+  } else if (t->border < INT64_MAX && k == t->border + 1 &&
+             k < INT64_MAX) { /* append */
+    t->border = isempty(getint(t, k + 1)) ? k : -1;
+  }
+}
+
+EXTERNAL_API void refhint_set(Table *t, const TValue *key,
+                              const TValue *value) {
+  ref_set(t, key, value);
+  updateborder(t, key, value);
+}
+
+EXTERNAL_API Table *ref_new() {
+  Table *t = (Table *)malloc(sizeof(Table));
+  t->asize = 0;
+  t->array = NULL;
+  t->border = 0;
+  setnodevector(t, 0);
+  return t;
+}
+
+EXTERNAL_API void ref_free(Table *t) {
+  freehash(t);
+  free(t->array);
+  free(t);
+}
+
+/*
+ * ===================================================================
+ * hashing for the open addressing variants
+ * ===================================================================
+ */
+
+/* finalizer of splitmix64, a bijection on 64 bits */
+INTERNAL_API uint64_t mix64(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+/* 'key' is normalized */
+INTERNAL_API uint64_t keyhash(const TValue *key) {
+  switch (key->tt_) {
+  case T_INT:
+    return mix64(l_castS2U(key->value_.i));
+  case T_FLT:
+    return mix64(cast_uint(l_hashfloat(key->value_.n)));
+  default:
+    return mix64(key->value_.s->hash);
+  }
+}
+
+/* normalized keys of the same type are equal iff their bits are equal */
+#define rawkeyeq(tt, v, k) ((tt) == (k)->tt_ && (v).i == (k)->value_.i)
+
+/*
+ * the open addressing hash parts never grow past 7/8 of their size; 'nhsize'
+ * keys need 2^ceil(log2(nhsize * 8 / 7 + 1)) slots
+ */
+#define MAXLOAD(size) ((size) - (size) / 8)
+
+INTERNAL_API unsigned int slotsfor(unsigned int nhsize, unsigned int minsize) {
+  if (nhsize == 0) {
+    return 0;
+  }
+  unsigned int size = twoto(ceillog2(nhsize + nhsize / 7 + 1));
+  return size < minsize ? minsize : size;
+}
+
+/*
+ * ===================================================================
+ * robin: linear probing, Robin Hood displacement
+ * ===================================================================
+ */
+
+typedef struct RNode {
+  Value value_;
+  byte tt_;
+  byte key_tt;
+  byte dist; /* 1 + distance to main position, 0 for a free slot */
+  Value key_val;
+} RNode;
+
+typedef struct RTable {
+  byte lsizenode;
+  unsigned int asize;
+  unsigned int nuse; /* number of used nodes */
+  TValue *array;
+  RNode *node;
+} RTable;
+
+#define rsizenode(t) ((t)->node ? twoto((t)->lsizenode) : 0u)
+#define rval(n) cast(TValue *, cast(void *, &(n)->value_))
+
+_Static_assert(offsetof(RNode, tt_) == offsetof(TValue, tt_),
+               "RNode value must be readable as a TValue");
+
+INTERNAL_API TValue *r_find(RTable *t, const TValue *key) {
+  unsigned int mask = rsizenode(t) - 1;
+  if (t->node == NULL) {
+    return NULL;
+  }
+  unsigned int pos = cast_uint(keyhash(key)) & mask;
+  for (byte d = 1;; d++) {
+    RNode *n = &t->node[pos];
+    if (n->dist < d) { /* a richer key would have been stored here */
+      return NULL;
+    }
+    if (rawkeyeq(n->key_tt, n->key_val, key)) {
+      return rval(n);
+    }
+    pos = (pos + 1) & mask;
+  }
+}
+
+EXTERNAL_API const TValue *robin_get(RTable *t, const TValue *key) {
+  TValue aux;
+  if (key->tt_ == T_NIL || (key->tt_ == T_FLT && isnan(key->value_.n))) {
+    return &absentkey;
+  }
+  key = normkey(key, &aux);
+  if (key->tt_ == T_INT && l_castS2U(key->value_.i) - 1u < t->asize) {
+    return &t->array[key->value_.i - 1];
+  }
+  TValue *v = r_find(t, key);
+  return v ? v : &absentkey;
+}
+
+/* insert a key known to be absent into a hash part with room for it */
+INTERNAL_API void r_insert(RTable *t, const TValue *key, const TValue *value) {
+  unsigned int mask = rsizenode(t) - 1;
+  RNode cur = {value->value_, value->tt_, key->tt_, 1, key->value_};
+  unsigned int pos = cast_uint(keyhash(key)) & mask;
+  t->nuse++;
+  for (;;) {
+    RNode *n = &t->node[pos];
+    if (n->dist == 0) {
+      *n = cur;
+      return;
+    }
+    if (n->dist < cur.dist) { /* take from the rich */
+      RNode tmp = *n;
+      *n = cur;
+      cur = tmp;
+    }
+    if (cur.dist == UCHAR_MAX) {
+      error("probe sequence too long");
+    }
+    cur.dist++;
+    pos = (pos + 1) & mask;
+  }
+}
+
+INTERNAL_API void r_resize(RTable *t, unsigned int newasize,
+                           unsigned int nhsize) {
+  RNode *oldnode = t->node;
+  unsigned int oldsize = rsizenode(t);
+  unsigned int oldasize = t->asize;
+  unsigned int size = slotsfor(nhsize, 1);
+  t->nuse = 0;
+  t->node = NULL;
+  t->lsizenode = 0;
+  if (size > 0) {
+    t->node = (RNode *)calloc(size, sizeof(RNode));
+    if (t->node == NULL) {
+      error("not enough memory");
+    }
+    t->lsizenode = cast(byte, ceillog2(size));
+  }
+  /* vanishing slice of the array goes to the new hash part */
+  for (unsigned int i = newasize; i < oldasize; i++) {
+    if (!isempty(&t->array[i])) {
+      TValue k = {{.i = i + 1}, T_INT};
+      r_insert(t, &k, &t->array[i]);
+    }
+  }
+  t->array = resizearray(t->array, oldasize, newasize);
+  t->asize = newasize;
+  for (unsigned int i = 0; i < oldsize; i++) {
+    RNode *n = &oldnode[i];
+    if (n->dist != 0 && !isempty(rval(n))) {
+      TValue k = {n->key_val, n->key_tt};
+      if (k.tt_ == T_INT && l_castS2U(k.value_.i) - 1u < newasize) {
+        setobj(&t->array[k.value_.i - 1], rval(n));
+      } else {
+        r_insert(t, &k, rval(n));
+      }
+    }
+  }
+  free(oldnode);
+}
+
+INTERNAL_API void r_rehash(RTable *t, const TValue *ek) {
+  unsigned int nums[MAXABITS + 1] = {0};
+  unsigned int na = numusearray(t->array, t->asize, nums);
+  unsigned int totaluse = na;
+  for (unsigned int i = 0; i < rsizenode(t); i++) {
+    RNode *n = &t->node[i];
+    if (n->dist != 0 && !isempty(rval(n))) {
+      if (n->key_tt == T_INT) {
+        na += countint(n->key_val.i, nums);
+      }
+      totaluse++;
+    }
+  }
+  if (ek->tt_ == T_INT) {
+    na += countint(ek->value_.i, nums);
+  }
+  totaluse++;
+  unsigned int asize = computesizes(nums, &na);
+  r_resize(t, asize, totaluse - na);
+}
+
+EXTERNAL_API void robin_set(RTable *t, const TValue *key, const TValue *value) {
+  TValue aux;
+  const TValue *slot = robin_get(t, key);
+  if (!isabstkey(slot)) {
+    setobj(cast(TValue *, slot), value);
+    return;
+  }
+  key = normkey(key, &aux);
+  if (isempty(value)) {
+    return;
+  }
+  if (t->nuse + 1 > MAXLOAD(rsizenode(t))) {
+    r_rehash(t, key);
+    robin_set(t, key, value);
+    return;
+  }
+  r_insert(t, key, value);
+}
+
+EXTERNAL_API RTable *robin_new() {
+  RTable *t = (RTable *)calloc(1, sizeof(RTable));
+  return t;
+}
+
+EXTERNAL_API void robin_free(RTable *t) {
+  free(t->node);
+  free(t->array);
+  free(t);
+}
+
+/*
+ * ===================================================================
+ * swiss: 16 metadata bytes per group, one per slot
+ * ===================================================================
+ */
+
+#define GROUP 16
+#define CTRL_EMPTY 0x80 /* full slots hold the low 7 bits of the hash */
+
+typedef struct SSlot {
+  Value value_;
+  byte tt_;
+  byte key_tt;
+  Value key_val;
+} SSlot;
+
+typedef struct STable {
+  byte lsizenode;
+  unsigned int asize;
+  unsigned int nuse;
+  TValue *array;
+  byte *ctrl;
+  SSlot *slot;
+} STable;
+
+#define ssizenode(t) ((t)->ctrl ? twoto((t)->lsizenode) : 0u)
+#define sval(s) cast(TValue *, cast(void *, &(s)->value_))
+
+_Static_assert(offsetof(SSlot, tt_) == offsetof(TValue, tt_),
+               "SSlot value must be readable as a TValue");
+#define h1(h) ((h) >> 7)
+#define h2(h) cast(byte, (h) & 0x7F)
+
+#if defined(__SSE2__)
+/* bit 'i' set when ctrl[i] == b */
+INTERNAL_API unsigned int group_match(const byte *ctrl, byte b) {
+  __m128i g = _mm_load_si128(cast(const __m128i *, ctrl));
+  return cast_uint(_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(b))));
+}
+
+/* bit 'i' set when slot 'i' is empty (the only byte with its high bit on) */
+INTERNAL_API unsigned int group_empty(const byte *ctrl) {
+  __m128i g = _mm_load_si128(cast(const __m128i *, ctrl));
+  return cast_uint(_mm_movemask_epi8(g));
+}
+#else
+INTERNAL_API unsigned int group_match(const byte *ctrl, byte b) {
+  unsigned int m = 0;
+  for (int i = 0; i < GROUP; i++) {
+    m |= cast_uint(ctrl[i] == b) << i;
+  }
+  return m;
+}
+
+INTERNAL_API unsigned int group_empty(const byte *ctrl) {
+  return group_match(ctrl, CTRL_EMPTY);
+}
+#endif
+
+INTERNAL_API TValue *s_find(STable *t, const TValue *key) {
+  if (t->ctrl == NULL) {
+    return NULL;
+  }
+  uint64_t h = keyhash(key);
+  unsigned int gmask = ssizenode(t) / GROUP - 1;
+  unsigned int g = cast_uint(h1(h)) & gmask;
+  for (unsigned int probe = 1;; probe++) {
+    const byte *ctrl = t->ctrl + g * GROUP;
+    for (unsigned int m = group_match(ctrl, h2(h)); m; m &= m - 1) {
+      SSlot *s = &t->slot[g * GROUP + __builtin_ctz(m)];
+      if (rawkeyeq(s->key_tt, s->key_val, key)) {
+        return sval(s);
+      }
+    }
+    if (group_empty(ctrl)) { /* no deletions, so the key would be here */
+      return NULL;
+    }
+    g = (g + probe) & gmask; /* triangular numbers visit every group */
+  }
+}
+
+EXTERNAL_API const TValue *swiss_get(STable *t, const TValue *key) {
+  TValue aux;
+  if (key->tt_ == T_NIL || (key->tt_ == T_FLT && isnan(key->value_.n))) {
+    return &absentkey;
+  }
+  key = normkey(key, &aux);
+  if (key->tt_ == T_INT && l_castS2U(key->value_.i) - 1u < t->asize) {
+    return &t->array[key->value_.i - 1];
+  }
+  TValue *v = s_find(t, key);
+  return v ? v : &absentkey;
+}
+
+INTERNAL_API void s_insert(STable *t, const TValue *key, const TValue *value) {
+  uint64_t h = keyhash(key);
+  unsigned int gmask = ssizenode(t) / GROUP - 1;
+  unsigned int g = cast_uint(h1(h)) & gmask;
+  for (unsigned int probe = 1;; probe++) {
+    unsigned int m = group_empty(t->ctrl + g * GROUP);
+    if (m) {
+      unsigned int i = g * GROUP + __builtin_ctz(m);
+      t->ctrl[i] = h2(h);
+      t->slot[i] = (SSlot){value->value_, value->tt_, key->tt_, key->value_};
+      t->nuse++;
+      return;
+    }
+    g = (g + probe) & gmask;
+  }
+}
+
+INTERNAL_API void s_resize(STable *t, unsigned int newasize,
+                           unsigned int nhsize) {
+  byte *oldctrl = t->ctrl;
+  SSlot *oldslot = t->slot;
+  unsigned int oldsize = ssizenode(t);
+  unsigned int oldasize = t->asize;
+  unsigned int size = slotsfor(nhsize, GROUP);
+  t->nuse = 0;
+  t->ctrl = NULL;
+  t->slot = NULL;
+  t->lsizenode = 0;
+  if (size > 0) {
+    t->ctrl = (byte *)aligned_alloc(GROUP, size);
+    t->slot = (SSlot *)malloc(size * sizeof(SSlot));
+    if (t->ctrl == NULL || t->slot == NULL) {
+      error("not enough memory");
+    }
+    memset(t->ctrl, CTRL_EMPTY, size);
+    t->lsizenode = cast(byte, ceillog2(size));
+  }
+  for (unsigned int i = newasize; i < oldasize; i++) {
+    if (!isempty(&t->array[i])) {
+      TValue k = {{.i = i + 1}, T_INT};
+      s_insert(t, &k, &t->array[i]);
+    }
+  }
+  t->array = resizearray(t->array, oldasize, newasize);
+  t->asize = newasize;
+  for (unsigned int i = 0; i < oldsize; i++) {
+    SSlot *s = &oldslot[i];
+    if (oldctrl[i] != CTRL_EMPTY && !isempty(sval(s))) {
+      TValue k = {s->key_val, s->key_tt};
+      if (k.tt_ == T_INT && l_castS2U(k.value_.i) - 1u < newasize) {
+        setobj(&t->array[k.value_.i - 1], sval(s));
+      } else {
+        s_insert(t, &k, sval(s));
+      }
+    }
+  }
+  free(oldctrl);
+  free(oldslot);
+}
+
+INTERNAL_API void s_rehash(STable *t, const TValue *ek) {
+  unsigned int nums[MAXABITS + 1] = {0};
+  unsigned int na = numusearray(t->array, t->asize, nums);
+  unsigned int totaluse = na;
+  for (unsigned int i = 0; i < ssizenode(t); i++) {
+    SSlot *s = &t->slot[i];
+    if (t->ctrl[i] != CTRL_EMPTY && !isempty(sval(s))) {
+      if (s->key_tt == T_INT) {
+        na += countint(s->key_val.i, nums);
+      }
+      totaluse++;
+    }
+  }
+  if (ek->tt_ == T_INT) {
+    na += countint(ek->value_.i, nums);
+  }
+  totaluse++;
+  unsigned int asize = computesizes(nums, &na);
+  s_resize(t, asize, totaluse - na);
+}
+
+EXTERNAL_API void swiss_set(STable *t, const TValue *key, const TValue *value) {
+  TValue aux;
+  const TValue *slot = swiss_get(t, key);
+  if (!isabstkey(slot)) {
+    setobj(cast(TValue *, slot), value);
+    return;
+  }
+  key = normkey(key, &aux);
+  if (isempty(value)) {
+    return;
+  }
+  if (t->nuse + 1 > MAXLOAD(ssizenode(t))) {
+    s_rehash(t, key);
+    swiss_set(t, key, value);
+    return;
+  }
+  s_insert(t, key, value);
+}
+
+EXTERNAL_API STable *swiss_new() {
+  STable *t = (STable *)calloc(1, sizeof(STable));
+  return t;
+}
+
+EXTERNAL_API void swiss_free(STable *t) {
+  free(t->ctrl);
+  free(t->slot);
+  free(t->array);
+  free(t);
+}
+
+/*
+ * ===================================================================
+ * benchmark harness
+ * ===================================================================
+ */
+
+typedef struct Engine {
+  const char *name;
+  void *(*create)(void);
+  void (*set)(void *t, const TValue *key, const TValue *value);
+  const TValue *(*get)(void *t, const TValue *key);
+  void (*destroy)(void *t);
+} Engine;
+
+#define engine(prefix)                                                         \
+  {#prefix, cast(void *(*)(void), prefix##_new),                               \
+   cast(void (*)(void *, const TValue *, const TValue *), prefix##_set),       \
+   cast(const TValue *(*)(void *, const TValue *), prefix##_get),              \
+   cast(void (*)(void *), prefix##_free)}
+
+static const Engine engines[] = {engine(ref), engine(robin), engine(swiss)};
+
+#define NENGINES (sizeof(engines) / sizeof(engines[0]))
+
+INTERNAL_API uint32_t stringhash(const char *str, size_t l, uint32_t seed) {
+  uint32_t hash = seed ^ cast(uint32_t, l);
+  for (; l > 0; l--) {
+    hash ^= ((hash << 5) + (hash >> 2) + cast(uint32_t, str[l - 1]));
+  }
+  return hash;
+}
+
+/* the strings are all different, so they are 'interned' by construction */
+INTERNAL_API String *newstr(const char *fmt, unsigned int i) {
+  char buf[32];
+  size_t len = cast(size_t, snprintf(buf, sizeof(buf), fmt, i));
+  String *s = (String *)malloc(offsetof(String, contents) + len + 1);
+  s->len = len;
+  s->hash = stringhash(buf, len, 0xAAAB);
+  memcpy(s->contents, buf, len + 1);
+  return s;
+}
+
+enum { K_SEQ, K_INT, K_STR, K_FLT, NKINDS };
+static const char *kindname[NKINDS] = {"int seq", "int rand", "short str",
+                                       "float"};
+
+/* key 'i' of a kind; 'miss' keys are never equal to any 'hit' key */
+INTERNAL_API TValue makekey(int kind, unsigned int i, int miss, String **strs) {
+  TValue k;
+  switch (kind) {
+  case K_SEQ:
+    k.tt_ = T_INT;
+    k.value_.i = miss ? -cast(int64_t, i) : cast(int64_t, i) + 1;
+    break;
+  case K_INT:
+    k.tt_ = T_INT;
+    k.value_.i = cast(int64_t, mix64(2 * cast(uint64_t, i) + cast_uint(miss)));
+    break;
+  case K_STR:
+    k.tt_ = T_STR;
+    k.value_.s = strs[i];
+    break;
+  default:
+    k.tt_ = T_FLT;
+    k.value_.n = (miss ? -1.0 : 1.0) * (cast_num(i) + 0.5);
+    break;
+  }
+  return k;
+}
+
+INTERNAL_API double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast_num(ts.tv_sec) + cast_num(ts.tv_nsec) * 1e-9;
+}
+
+INTERNAL_API void bench(unsigned int n) {
+  TValue *hit = (TValue *)malloc(n * sizeof(TValue));
+  TValue *miss = (TValue *)malloc(n * sizeof(TValue));
+  unsigned int *order = (unsigned int *)malloc(n * sizeof(unsigned int));
+  String **hitstr = (String **)malloc(n * sizeof(String *));
+  String **missstr = (String **)malloc(n * sizeof(String *));
+  for (unsigned int i = 0; i < n; i++) {
+    hitstr[i] = newstr("key%u", i);
+    missstr[i] = newstr("miss%u", i);
+    order[i] = i;
+  }
+  srand(0x1234);
+  for (unsigned int i = n - 1; i > 0; i--) { /* lookups in random order */
+    unsigned int j = cast_uint(rand()) % (i + 1);
+    unsigned int tmp = order[i];
+    order[i] = order[j];
+    order[j] = tmp;
+  }
+
+  printf("n = %u\n", n);
+  printf("%-10s | %-6s | %12s | %12s | %12s\n", "keys", "engine", "insert",
+         "hit", "miss");
+  for (int kind = 0; kind < NKINDS; kind++) {
+    for (unsigned int i = 0; i < n; i++) {
+      hit[i] = makekey(kind, i, 0, hitstr);
+      miss[i] = makekey(kind, i, 1, missstr);
+    }
+    for (size_t e = 0; e < NENGINES; e++) {
+      const Engine *en = &engines[e];
+      void *t = en->create();
+      int64_t sum = 0;
+
+      double start = now();
+      for (unsigned int i = 0; i < n; i++) {
+        TValue v = {{.i = i}, T_INT};
+        en->set(t, &hit[i], &v);
+      }
+      double tinsert = now() - start;
+
+      start = now();
+      for (unsigned int i = 0; i < n; i++) {
+        sum += en->get(t, &hit[order[i]])->value_.i;
+      }
+      double thit = now() - start;
+      assert(sum == cast(int64_t, n) * (n - 1) / 2);
+
+      start = now();
+      for (unsigned int i = 0; i < n; i++) {
+        sum += !isabstkey(en->get(t, &miss[i]));
+      }
+      double tmiss = now() - start;
+      assert(sum == cast(int64_t, n) * (n - 1) / 2);
+
+      for (unsigned int i = 0; i < n; i++) { /* every key maps to its value */
+        const TValue *v = en->get(t, &hit[i]);
+        assert(v->tt_ == T_INT && v->value_.i == i);
+      }
+
+      printf("%-10s | %-6s | %9.2f ns | %9.2f ns | %9.2f ns\n", kindname[kind],
+             en->name, tinsert * 1e9 / n, thit * 1e9 / n, tmiss * 1e9 / n);
+      en->destroy(t);
+    }
+  }
+  printf("\n");
+
+  for (unsigned int i = 0; i < n; i++) {
+    free(hitstr[i]);
+    free(missstr[i]);
+  }
+  free(hitstr);
+  free(missstr);
+  free(order);
+  free(miss);
+  free(hit);
+}
+
+/* the same operations give the same contents in every engine */
+INTERNAL_API void test_engines() {
+  String *s = newstr("key%u", 0);
+  for (size_t e = 0; e < NENGINES; e++) {
+    const Engine *en = &engines[e];
+    void *t = en->create();
+    TValue one = {{.i = 1}, T_INT}, two = {{.i = 2}, T_INT};
+    TValue nil = {{0}, T_NIL};
+    TValue kflt = {{.n = 3.0}, T_FLT}, kint = {{.i = 3}, T_INT};
+    TValue kstr = {{.s = s}, T_STR}, khalf = {{.n = 0.5}, T_FLT};
+
+    en->set(t, &kflt, &one); /* 3.0 is stored as integer 3 */
+    assert(en->get(t, &kint)->value_.i == 1);
+    en->set(t, &kint, &two);
+    assert(en->get(t, &kflt)->value_.i == 2);
+    en->set(t, &kstr, &one);
+    en->set(t, &khalf, &two);
+    assert(en->get(t, &kstr)->value_.i == 1);
+    assert(en->get(t, &khalf)->value_.i == 2);
+    en->set(t, &kstr, &nil); /* removal leaves an empty value */
+    assert(isempty(en->get(t, &kstr)));
+
+    /* sequential keys end up in the array part after rehashes */
+    for (int64_t i = 1; i <= 1000; i++) {
+      TValue k = {{.i = i}, T_INT};
+      en->set(t, &k, &k);
+    }
+    for (int64_t i = 1; i <= 1000; i++) {
+      TValue k = {{.i = i}, T_INT};
+      assert(en->get(t, &k)->value_.i == i);
+    }
+    assert(en->get(t, &khalf)->value_.i == 2);
+    printf("%s: passed\n", en->name);
+    en->destroy(t);
+  }
+  free(s);
+}
+
+/* is 'b' a border of 't'? */
+INTERNAL_API int isborder(Table *t, uint64_t b) {
+  return (b == 0 || !isempty(getint(t, cast(int64_t, b)))) &&
+         isempty(getint(t, cast(int64_t, b) + 1));
+}
+
+/* random appends, removals and writes anywhere keep both lengths borders */
+INTERNAL_API void test_border() {
+  Table *t = ref_new();
+  TValue nil = {{0}, T_NIL};
+  srand(0x4321);
+  for (int i = 0; i < 200000; i++) {
+    int64_t n = cast(int64_t, refhint_getn(t));
+    TValue k = {{.i = n + 1}, T_INT};
+    const TValue *v = &k;
+    switch (rand() % 8) {
+    case 0: case 1: case 2: /* t[#t + 1] = v */
+      break;
+    case 3: case 4: /* t[#t] = nil */
+      k.value_.i = n;
+      v = &nil;
+      break;
+    case 5: /* t[k] = v or nil, anywhere */
+      k.value_.i = rand() % 512;
+      v = rand() % 2 ? &k : &nil;
+      break;
+    case 6: /* as a float key */
+      k.tt_ = T_FLT;
+      k.value_.n = cast_num(n + 1);
+      break;
+    default: /* consult the baseline, which drops nothing */
+      assert(isborder(t, ref_getn(t)));
+      continue;
+    }
+    refhint_set(t, &k, v);
+    assert(t->border < 0 || isborder(t, l_castS2U(t->border)));
+    assert(isborder(t, refhint_getn(t)));
+  }
+  printf("border: passed\n");
+  ref_free(t);
+}
+
+INTERNAL_API void bench_getn(unsigned int n) {
+  static const struct {
+    const char *name;
+    void (*set)(Table *t, const TValue *key, const TValue *value);
+    uint64_t (*getn)(Table *t);
+  } lens[] = {{"binsearch", ref_set, ref_getn},
+              {"hint", refhint_set, refhint_getn}};
+  TValue nil = {{0}, T_NIL};
+
+  printf("n = %u\n", n);
+  printf("%-10s | %12s | %12s | %12s | %12s\n", "getn", "append", "#t full",
+         "#t 3/4 full", "remove");
+  for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+    void (*set)(Table *t, const TValue *key, const TValue *value) =
+        lens[l].set;
+    uint64_t (*getn)(Table *t) = lens[l].getn;
+    Table *t = ref_new();
+    uint64_t sum = 0;
+    double tpart = 0;
+
+    /* t[#t + 1] = v, the array part grows by rehash */
+    double start = now();
+    for (unsigned int i = 0; i < n; i++) {
+      TValue k = {{.i = cast(int64_t, getn(t)) + 1}, T_INT};
+      set(t, &k, &k);
+    }
+    double tappend = now() - start;
+    assert(getn(t) == n);
+
+    /* #t on a full table, 'j + 1' is checked in the hash part */
+    start = now();
+    for (unsigned int i = 0; i < n; i++) {
+      sum += getn(t);
+    }
+    double tfull = now() - start;
+    assert(sum == cast(uint64_t, n) * n);
+
+    /* t[#t] = nil until empty, with #t on the table 3/4 full on the way */
+    unsigned int m = n - n / 4;
+    start = now();
+    for (unsigned int i = 0; i < n; i++) {
+      if (i == n / 4) {
+        double pause = now();
+        sum = 0;
+        for (unsigned int q = 0; q < n; q++) {
+          sum += getn(t);
+        }
+        tpart = now() - pause;
+        assert(sum == cast(uint64_t, m) * n);
+        start += tpart;
+      }
+      TValue k = {{.i = cast(int64_t, getn(t))}, T_INT};
+      set(t, &k, &nil);
+    }
+    double tremove = now() - start;
+    assert(getn(t) == 0);
+
+    printf("%-10s | %9.2f ns | %9.2f ns | %9.2f ns | %9.2f ns\n", lens[l].name,
+           tappend * 1e9 / n, tfull * 1e9 / n, tpart * 1e9 / n,
+           tremove * 1e9 / n);
+    ref_free(t);
+  }
+  printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+  printf("sizeof(Node): %zu, sizeof(RNode): %zu, sizeof(SSlot): %zu\n",
+         sizeof(Node), sizeof(RNode), sizeof(SSlot));
+  test_engines();
+  test_border();
+  unsigned int n = argc > 1 ? cast_uint(strtoul(argv[1], NULL, 10)) : 1u << 20;
+  bench(1u << 12);
+  bench(n);
+  bench_getn(1u << 12);
+  bench_getn(n);
+  return 0;
+}
@@ -0,0 +1,278 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "inc_malloc.h"
+#include "skynet_server.h"
+
+/*
+ * pingpong: NPAIR pairs of services bounce one message each, the message is
+ * handed back and forth, never copied nor reallocated.
+ *
+ * fanout: NPRODUCER producers send a fresh message to each of their NFAN
+ * consumers, which send it back as the ack; the next round starts when all
+ * the acks are in.
+ *
+ * latency is from skynet_send to the callback, every message is sampled.
+ *
+ * burst: before the benchmarks, check that a service sent many more messages
+ * than it handles per turn gets all of them, whether they were queued before
+ * the workers start or while they run.
+ */
+
+#define NPAIR 16
+#define NPRODUCER 4
+#define NFAN 16
+#define PAYLOAD 64
+
+struct samples {
+  uint64_t* v;
+  size_t n;
+};
+
+static void sample(struct samples* s, struct skynet_message* msg) {
+  s->v[s->n++] = skynet_now() - msg->stamp;
+}
+
+// the main thread waits for 'remaining' services to finish
+static atomic_int remaining;
+static pthread_mutex_t done_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+static void finish(void) {
+  if (atomic_fetch_sub(&remaining, 1) == 1) {
+    pthread_mutex_lock(&done_mutex);
+    pthread_cond_signal(&done_cond);
+    pthread_mutex_unlock(&done_mutex);
+  }
+}
+
+static void wait_finish(void) {
+  pthread_mutex_lock(&done_mutex);
+  while (atomic_load(&remaining) > 0) {
+    pthread_cond_wait(&done_cond, &done_mutex);
+  }
+  pthread_mutex_unlock(&done_mutex);
+}
+
+/* pingpong */
+
+struct player {
+  uint32_t peer;
+  int rounds;
+  struct samples lat;
+};
+
+static void player_cb(struct skynet_context* ctx, void* ud, struct skynet_message* msg) {
+  struct player* p = (struct player*)ud;
+  sample(&p->lat, msg);
+  if (++msg->session >= p->rounds) {
+    skynet_message_free(msg);
+    finish();
+    return;
+  }
+  skynet_send(skynet_context_scheduler(ctx), skynet_context_handle(ctx), p->peer, msg);
+}
+
+/* fanout */
+
+struct producer {
+  uint32_t consumer[NFAN];
+  int rounds;
+  int acks;
+};
+
+struct consumer {
+  struct samples lat;
+};
+
+static void producer_round(struct skynet_context* ctx, struct producer* p) {
+  struct skynet_scheduler* s = skynet_context_scheduler(ctx);
+  for (int i = 0; i < NFAN; i++) {
+    struct skynet_message* msg = skynet_message_new(PAYLOAD);
+    memset(skynet_message_data(msg), i, PAYLOAD);
+    skynet_send(s, skynet_context_handle(ctx), p->consumer[i], msg);
+  }
+}
+
+static void producer_cb(struct skynet_context* ctx, void* ud, struct skynet_message* msg) {
+  struct producer* p = (struct producer*)ud;
+  if (msg->source != 0) { // an ack
+    if (++p->acks < NFAN) {
+      skynet_message_free(msg);
+      return;
+    }
+    p->acks = 0;
+    if (--p->rounds == 0) {
+      skynet_message_free(msg);
+      finish();
+      return;
+    }
+  }
+  skynet_message_free(msg);
+  producer_round(ctx, p);
+}
+
+static void consumer_cb(struct skynet_context* ctx, void* ud, struct skynet_message* msg) {
+  struct consumer* c = (struct consumer*)ud;
+  sample(&c->lat, msg);
+  skynet_send(skynet_context_scheduler(ctx), skynet_context_handle(ctx), msg->source, msg);
+}
+
+/* burst */
+
+static atomic_int delivered;
+
+static void burst_cb(struct skynet_context* ctx, void* ud, struct skynet_message* msg) {
+  atomic_fetch_add(&delivered, 1);
+  skynet_message_free(msg);
+}
+
+// 0 if some of the 'n' messages never arrive
+static int burst(int nworker, int n, int started) {
+  struct skynet_scheduler* s = skynet_scheduler_new(nworker, 1);
+  uint32_t h = skynet_context_new(s, burst_cb, NULL);
+  atomic_store(&delivered, 0);
+  if (started) {
+    skynet_scheduler_start(s);
+  }
+  for (int i = 0; i < n; i++) {
+    skynet_send(s, 0, h, skynet_message_new(0));
+  }
+  if (!started) {
+    skynet_scheduler_start(s);
+  }
+  struct timespec ts = {0, 1000000};
+  for (int ms = 0; ms < 1000 && atomic_load(&delivered) < n; ms++) {
+    nanosleep(&ts, NULL);
+  }
+  int got = atomic_load(&delivered);
+  skynet_scheduler_delete(s);
+  if (got != n) {
+    printf("burst: %d workers, %d sent %s, %d delivered\n", nworker, n,
+           started ? "while running" : "before start", got);
+    return 0;
+  }
+  return 1;
+}
+
+static void test_burst(void) {
+  static const int sizes[] = {1, 15, 16, 17, 32, 33, 100, 1000};
+  int ok = 1;
+  for (int nworker = 1; nworker <= 4; nworker *= 2) {
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+      ok &= burst(nworker, sizes[i], 0);
+      ok &= burst(nworker, sizes[i], 1);
+    }
+  }
+  if (!ok) {
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* report */
+
+static int cmp_u64(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+static void report(const char* name, int nworker, size_t nmsg, double sec, struct samples** all, int n) {
+  size_t total = 0;
+  for (int i = 0; i < n; i++) {
+    total += all[i]->n;
+  }
+  uint64_t* v = (uint64_t*)malloc(total * sizeof(uint64_t));
+  size_t k = 0;
+  for (int i = 0; i < n; i++) {
+    memcpy(v + k, all[i]->v, all[i]->n * sizeof(uint64_t));
+    k += all[i]->n;
+  }
+  qsort(v, total, sizeof(uint64_t), cmp_u64);
+  printf("%-8s | %7d | %10.3f | %10.2f | %10.2f\n", name, nworker, nmsg / sec / 1e6,
+         v[total / 2] / 1e3, v[total * 99 / 100] / 1e3);
+  free(v);
+}
+
+static void samples_init(struct samples* s, size_t cap) {
+  s->v = (uint64_t*)malloc(cap * sizeof(uint64_t));
+  s->n = 0;
+}
+
+static void bench_pingpong(int nworker, int rounds) {
+  struct skynet_scheduler* s = skynet_scheduler_new(nworker, 2 * NPAIR);
+  struct player p[2 * NPAIR];
+  struct samples* all[2 * NPAIR];
+  uint32_t h[2 * NPAIR];
+  for (int i = 0; i < 2 * NPAIR; i++) {
+    p[i].rounds = rounds;
+    samples_init(&p[i].lat, rounds);
+    all[i] = &p[i].lat;
+    h[i] = skynet_context_new(s, player_cb, &p[i]);
+  }
+  for (int i = 0; i < 2 * NPAIR; i++) {
+    p[i].peer = h[i ^ 1];
+  }
+  atomic_store(&remaining, NPAIR);
+  skynet_scheduler_start(s);
+  uint64_t start = skynet_now();
+  for (int i = 0; i < NPAIR; i++) {
+    struct skynet_message* msg = skynet_message_new(PAYLOAD);
+    skynet_send(s, h[2 * i + 1], h[2 * i], msg);
+  }
+  wait_finish();
+  double sec = (skynet_now() - start) / 1e9;
+  skynet_scheduler_delete(s);
+  report("pingpong", nworker, (size_t)NPAIR * rounds, sec, all, 2 * NPAIR);
+  for (int i = 0; i < 2 * NPAIR; i++) {
+    free(p[i].lat.v);
+  }
+}
+
+static void bench_fanout(int nworker, int rounds) {
+  struct skynet_scheduler* s = skynet_scheduler_new(nworker, NPRODUCER * (NFAN + 1));
+  struct producer p[NPRODUCER];
+  struct consumer c[NPRODUCER * NFAN];
+  struct samples* all[NPRODUCER * NFAN];
+  uint32_t h[NPRODUCER];
+  for (int i = 0; i < NPRODUCER; i++) {
+    p[i].rounds = rounds;
+    p[i].acks = 0;
+    for (int j = 0; j < NFAN; j++) {
+      struct consumer* cc = &c[i * NFAN + j];
+      samples_init(&cc->lat, rounds);
+      all[i * NFAN + j] = &cc->lat;
+      p[i].consumer[j] = skynet_context_new(s, consumer_cb, cc);
+    }
+    h[i] = skynet_context_new(s, producer_cb, &p[i]);
+  }
+  atomic_store(&remaining, NPRODUCER);
+  skynet_scheduler_start(s);
+  uint64_t start = skynet_now();
+  for (int i = 0; i < NPRODUCER; i++) {
+    skynet_send(s, 0, h[i], skynet_message_new(0)); // the first round
+  }
+  wait_finish();
+  double sec = (skynet_now() - start) / 1e9;
+  skynet_scheduler_delete(s);
+  // the fan-out leg only, the acks are counted in the throughput
+  report("fanout", nworker, (size_t)NPRODUCER * NFAN * rounds * 2, sec, all, NPRODUCER * NFAN);
+  for (int i = 0; i < NPRODUCER * NFAN; i++) {
+    free(c[i].lat.v);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  int maxworker = argc > 1 ? atoi(argv[1]) : 32;
+  int rounds = argc > 2 ? atoi(argv[2]) : 20000;
+  test_burst();
+  printf("%-8s | %7s | %10s | %10s | %10s\n", "bench", "workers", "Mmsg/s", "p50 us", "p99 us");
+  for (int n = 1; n <= maxworker; n *= 2) {
+    bench_pingpong(n, rounds);
+  }
+  for (int n = 1; n <= maxworker; n *= 2) {
+    bench_fanout(n, rounds / 10);
+  }
+  return 0;
+}
@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <time.h>
+#include "inc_malloc.h"
+#include "skynet_mq.h"
+
+struct skynet_message* skynet_message_new(size_t sz) {
+  struct skynet_message* msg = (struct skynet_message*)inc_malloc(sizeof(*msg) + sz);
+  atomic_store_explicit(&msg->next, NULL, memory_order_relaxed);
+  msg->source = 0;
+  msg->session = 0;
+  msg->stamp = 0;
+  msg->sz = sz;
+  return msg;
+}
+
+void skynet_message_free(struct skynet_message* msg) {
+  inc_free(msg);
+}
+
+void skynet_mq_init(struct message_queue* q) {
+  atomic_store_explicit(&q->stub.next, NULL, memory_order_relaxed);
+  atomic_store_explicit(&q->tail, &q->stub, memory_order_relaxed);
+  q->head = &q->stub;
+}
+
+void skynet_mq_push(struct message_queue* q, struct skynet_message* msg) {
+  atomic_store_explicit(&msg->next, NULL, memory_order_relaxed);
+  // from here 'msg' is the tail, but not reachable from 'prev' yet
+  struct skynet_message* prev = atomic_exchange_explicit(&q->tail, msg, memory_order_acq_rel);
+  atomic_store_explicit(&prev->next, msg, memory_order_release);
+}
+
+struct skynet_message* skynet_mq_pop(struct message_queue* q) {
+  struct skynet_message* head = q->head;
+  struct skynet_message* next = atomic_load_explicit(&head->next, memory_order_acquire);
+  if (head == &q->stub) {
+    if (next == NULL) {
+      return NULL;
+    }
+    q->head = next;
+    head = next;
+    next = atomic_load_explicit(&head->next, memory_order_acquire);
+  }
+  if (next != NULL) {
+    q->head = next;
+    return head;
+  }
+  // 'head' is the last message, put the stub behind it to take it out
+  if (head != atomic_load_explicit(&q->tail, memory_order_acquire)) {
+    return NULL; // a producer is between its exchange and its link
+  }
+  skynet_mq_push(q, &q->stub);
+  next = atomic_load_explicit(&head->next, memory_order_acquire);
+  if (next != NULL) {
+    q->head = next;
+    return head;
+  }
+  return NULL;
+}
+
+#define SPIN_LOCK(q) while (atomic_flag_test_and_set_explicit(&(q)->lock, memory_order_acquire)) {}
+#define SPIN_UNLOCK(q) atomic_flag_clear_explicit(&(q)->lock, memory_order_release)
+
+void skynet_globalmq_init(struct global_queue* q) {
+  atomic_flag_clear(&q->lock);
+  q->head = NULL;
+  q->tail = NULL;
+  atomic_init(&q->size, 0);
+}
+
+void skynet_globalmq_push(struct global_queue* q, struct global_node* node) {
+  node->next = NULL;
+  SPIN_LOCK(q);
+  if (q->tail) {
+    q->tail->next = node;
+  } else {
+    q->head = node;
+  }
+  q->tail = node;
+  atomic_fetch_add(&q->size, 1);
+  SPIN_UNLOCK(q);
+}
+
+struct global_node* skynet_globalmq_pop(struct global_queue* q) {
+  if (atomic_load_explicit(&q->size, memory_order_relaxed) == 0) {
+    return NULL;
+  }
+  SPIN_LOCK(q);
+  struct global_node* node = q->head;
+  if (node) {
+    q->head = node->next;
+    if (q->head == NULL) {
+      q->tail = NULL;
+    }
+    atomic_fetch_sub(&q->size, 1);
+  }
+  SPIN_UNLOCK(q);
+  return node;
+}
+
+uint64_t skynet_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
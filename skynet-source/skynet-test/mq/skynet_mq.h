@@ -0,0 +1,62 @@
+#ifndef __SKYNET_MQ_H__
+#define __SKYNET_MQ_H__
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * a message and its payload are one inc_malloc block. skynet_send hands the
+ * pointer over: the sender must not touch it afterwards, the receiver either
+ * frees it with skynet_message_free or sends it on.
+ */
+struct skynet_message {
+  struct skynet_message* _Atomic next; // link in the mailbox, owned by it
+  uint32_t source;
+  int session;
+  uint64_t stamp; // skynet_now() when sent
+  size_t sz; // payload follows the header
+};
+
+#define skynet_message_data(msg) ((void*)((msg) + 1))
+
+struct skynet_message* skynet_message_new(size_t sz);
+void skynet_message_free(struct skynet_message* msg);
+
+/*
+ * per-service mailbox, intrusive MPSC queue (Vyukov): any thread pushes with
+ * one atomic exchange, only the thread running the service pops.
+ */
+struct message_queue {
+  struct skynet_message* _Atomic tail; // producers
+  struct skynet_message* head;         // consumer
+  struct skynet_message stub;
+};
+
+void skynet_mq_init(struct message_queue* q);
+void skynet_mq_push(struct message_queue* q, struct skynet_message* msg);
+// NULL when empty, or when a push is halfway done (then 'tail' != 'head')
+struct skynet_message* skynet_mq_pop(struct message_queue* q);
+
+/*
+ * global queue of runnable services, a spinlocked list as in skynet. the link
+ * lives in the queued object, which is in at most one queue at a time.
+ */
+struct global_node {
+  struct global_node* next;
+};
+
+struct global_queue {
+  atomic_flag lock;
+  struct global_node* head;
+  struct global_node* tail;
+  atomic_int size;
+};
+
+void skynet_globalmq_init(struct global_queue* q);
+void skynet_globalmq_push(struct global_queue* q, struct global_node* node);
+struct global_node* skynet_globalmq_pop(struct global_queue* q);
+
+uint64_t skynet_now(void); // monotonic, in ns
+
+#endif
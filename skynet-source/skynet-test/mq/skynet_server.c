@@ -0,0 +1,326 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include "inc_malloc.h"
+#include "skynet_server.h"
+
+/*
+ * services are scheduled like in skynet: a service with mail is in exactly
+ * one run queue ('in_global' is set) and is run by one worker at a time, so
+ * its mailbox has a single consumer.
+ *
+ * unlike skynet, a service woken up from a worker goes to that worker's own
+ * deque (Chase-Lev) rather than to the global queue: the message it was sent
+ * is still in cache there. idle workers steal from the top of the other
+ * deques. services woken up from outside, and services which used up their
+ * MESSAGE_WEIGHT, go to the global queue.
+ */
+
+#define MESSAGE_WEIGHT 16 // messages handled before the service is requeued
+#define IDLE_SPIN 64      // empty rounds before a worker goes to sleep
+
+struct skynet_context {
+  struct global_node node; // first, so the global queue holds contexts
+  atomic_int in_global;
+  uint32_t handle;
+  skynet_cb cb;
+  void* ud;
+  struct skynet_scheduler* sched;
+  struct message_queue mq;
+};
+
+// single producer (the owner, at 'bottom'), many thieves (at 'top')
+struct deque {
+  atomic_long top;
+  char pad[64 - sizeof(atomic_long)];
+  atomic_long bottom;
+  long mask;
+  struct skynet_context* _Atomic* buf;
+};
+
+struct worker {
+  struct skynet_scheduler* sched;
+  pthread_t thread;
+  unsigned int seed;
+  struct deque dq;
+};
+
+struct skynet_scheduler {
+  int nworker;
+  int maxservice;
+  struct worker* workers;
+  struct global_queue gq;
+  struct skynet_context* _Atomic* slot;
+  atomic_int nservice;
+  atomic_int quit;
+  atomic_int sleeping;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+};
+
+static _Thread_local struct worker* current;
+
+/* deque, from "Correct and Efficient Work-Stealing for Weak Memory Models" */
+
+static void deque_init(struct deque* d, int cap) {
+  long size = 1;
+  while (size < cap) {
+    size *= 2;
+  }
+  atomic_init(&d->top, 0);
+  atomic_init(&d->bottom, 0);
+  d->mask = size - 1;
+  d->buf = (struct skynet_context* _Atomic*)inc_malloc(size * sizeof(*d->buf));
+}
+
+static long deque_size(struct deque* d) {
+  return atomic_load(&d->bottom) - atomic_load(&d->top);
+}
+
+// never full: a service is in at most one queue and 'cap' >= maxservice
+static void deque_push(struct deque* d, struct skynet_context* ctx) {
+  long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+  atomic_store_explicit(&d->buf[b & d->mask], ctx, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+}
+
+static struct skynet_context* deque_pop(struct deque* d) {
+  long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+  atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+  if (t > b) { // empty
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return NULL;
+  }
+  struct skynet_context* ctx = atomic_load_explicit(&d->buf[b & d->mask], memory_order_relaxed);
+  if (t == b) { // the last one, race the thieves for it
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+      ctx = NULL;
+    }
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+  }
+  return ctx;
+}
+
+static struct skynet_context* deque_steal(struct deque* d) {
+  long t = atomic_load_explicit(&d->top, memory_order_acquire);
+  atomic_thread_fence(memory_order_seq_cst);
+  long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+  if (t >= b) {
+    return NULL;
+  }
+  struct skynet_context* ctx = atomic_load_explicit(&d->buf[t & d->mask], memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+    return NULL; // lost to the owner or another thief
+  }
+  return ctx;
+}
+
+/* scheduling */
+
+static void wakeup(struct skynet_scheduler* s) {
+  // pairs with the fence in worker_sleep: either we see the sleeper, or the
+  // sleeper sees the service we just queued
+  atomic_thread_fence(memory_order_seq_cst);
+  if (atomic_load_explicit(&s->sleeping, memory_order_relaxed) > 0) {
+    pthread_mutex_lock(&s->mutex);
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+  }
+}
+
+static void schedule(struct skynet_context* ctx) {
+  struct skynet_scheduler* s = ctx->sched;
+  struct worker* w = current;
+  if (w != NULL && w->sched == s) {
+    deque_push(&w->dq, ctx);
+    // this worker will run one of them, wake up a thief for the others
+    if (deque_size(&w->dq) > 1) {
+      wakeup(s);
+    }
+  } else {
+    skynet_globalmq_push(&s->gq, &ctx->node);
+    wakeup(s);
+  }
+}
+
+void skynet_send(struct skynet_scheduler* s, uint32_t source, uint32_t dest, struct skynet_message* msg) {
+  struct skynet_context* ctx = atomic_load_explicit(&s->slot[dest - 1], memory_order_acquire);
+  msg->source = source;
+  msg->stamp = skynet_now();
+  skynet_mq_push(&ctx->mq, msg);
+  if (atomic_exchange(&ctx->in_global, 1) == 0) {
+    schedule(ctx);
+  }
+}
+
+static void dispatch(struct skynet_context* ctx) {
+  struct message_queue* q = &ctx->mq;
+  for (int i = 0; i < MESSAGE_WEIGHT; i++) {
+    struct skynet_message* msg = skynet_mq_pop(q);
+    if (msg == NULL) {
+      break;
+    }
+    ctx->cb(ctx, ctx->ud, msg);
+  }
+  // the mailbox is empty when both ends are the stub: after MESSAGE_WEIGHT
+  // pops 'head' may be the last message, which is then also the tail
+  struct skynet_message* last = atomic_load(&q->tail);
+  if (q->head != &q->stub || last != &q->stub) { // more mail, let the others run first
+    skynet_globalmq_push(&ctx->sched->gq, &ctx->node);
+    wakeup(ctx->sched);
+    return;
+  }
+  // after this store, a sender that pushes will schedule the service itself;
+  // one that pushed since 'last' saw 'in_global' set, so catch its mail here
+  atomic_store(&ctx->in_global, 0);
+  if (atomic_load(&q->tail) != last && atomic_exchange(&ctx->in_global, 1) == 0) {
+    skynet_globalmq_push(&ctx->sched->gq, &ctx->node);
+    wakeup(ctx->sched);
+  }
+}
+
+static struct skynet_context* steal(struct worker* w) {
+  struct skynet_scheduler* s = w->sched;
+  int n = s->nworker;
+  int start = rand_r(&w->seed) % n;
+  for (int i = 0; i < n; i++) {
+    struct worker* victim = &s->workers[(start + i) % n];
+    if (victim != w) {
+      struct skynet_context* ctx = deque_steal(&victim->dq);
+      if (ctx) {
+        return ctx;
+      }
+    }
+  }
+  return NULL;
+}
+
+static int has_work(struct skynet_scheduler* s) {
+  if (atomic_load(&s->gq.size) > 0) {
+    return 1;
+  }
+  for (int i = 0; i < s->nworker; i++) {
+    if (deque_size(&s->workers[i].dq) > 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void worker_sleep(struct skynet_scheduler* s) {
+  pthread_mutex_lock(&s->mutex);
+  atomic_fetch_add(&s->sleeping, 1);
+  atomic_thread_fence(memory_order_seq_cst);
+  if (!has_work(s) && !atomic_load(&s->quit)) {
+    pthread_cond_wait(&s->cond, &s->mutex);
+  }
+  atomic_fetch_sub(&s->sleeping, 1);
+  pthread_mutex_unlock(&s->mutex);
+}
+
+static void* thread_worker(void* p) {
+  struct worker* w = (struct worker*)p;
+  struct skynet_scheduler* s = w->sched;
+  current = w;
+  int idle = 0;
+  while (!atomic_load_explicit(&s->quit, memory_order_relaxed)) {
+    struct skynet_context* ctx = deque_pop(&w->dq);
+    if (ctx == NULL) {
+      ctx = (struct skynet_context*)skynet_globalmq_pop(&s->gq);
+    }
+    if (ctx == NULL) {
+      ctx = steal(w);
+    }
+    if (ctx) {
+      dispatch(ctx);
+      idle = 0;
+    } else if (++idle < IDLE_SPIN) {
+      sched_yield();
+    } else {
+      worker_sleep(s);
+      idle = 0;
+    }
+  }
+  return NULL;
+}
+
+/* api */
+
+struct skynet_scheduler* skynet_scheduler_new(int nworker, int maxservice) {
+  struct skynet_scheduler* s = (struct skynet_scheduler*)inc_malloc(sizeof(*s));
+  s->nworker = nworker;
+  s->maxservice = maxservice;
+  s->workers = (struct worker*)inc_malloc(nworker * sizeof(struct worker));
+  for (int i = 0; i < nworker; i++) {
+    s->workers[i].sched = s;
+    s->workers[i].seed = (unsigned int)i * 2654435761u + 1;
+    deque_init(&s->workers[i].dq, maxservice);
+  }
+  skynet_globalmq_init(&s->gq);
+  s->slot = (struct skynet_context* _Atomic*)inc_malloc(maxservice * sizeof(*s->slot));
+  atomic_init(&s->nservice, 0);
+  atomic_init(&s->quit, 0);
+  atomic_init(&s->sleeping, 0);
+  pthread_mutex_init(&s->mutex, NULL);
+  pthread_cond_init(&s->cond, NULL);
+  return s;
+}
+
+void skynet_scheduler_start(struct skynet_scheduler* s) {
+  for (int i = 0; i < s->nworker; i++) {
+    pthread_create(&s->workers[i].thread, NULL, thread_worker, &s->workers[i]);
+  }
+}
+
+void skynet_scheduler_delete(struct skynet_scheduler* s) {
+  atomic_store(&s->quit, 1);
+  pthread_mutex_lock(&s->mutex);
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->mutex);
+  for (int i = 0; i < s->nworker; i++) {
+    pthread_join(s->workers[i].thread, NULL);
+    inc_free(s->workers[i].dq.buf);
+  }
+  int n = atomic_load(&s->nservice);
+  for (int i = 0; i < n; i++) {
+    struct skynet_context* ctx = s->slot[i];
+    struct skynet_message* msg;
+    while ((msg = skynet_mq_pop(&ctx->mq)) != NULL) {
+      skynet_message_free(msg);
+    }
+    inc_free(ctx);
+  }
+  pthread_mutex_destroy(&s->mutex);
+  pthread_cond_destroy(&s->cond);
+  inc_free(s->slot);
+  inc_free(s->workers);
+  inc_free(s);
+}
+
+uint32_t skynet_context_new(struct skynet_scheduler* s, skynet_cb cb, void* ud) {
+  int id = atomic_fetch_add(&s->nservice, 1);
+  if (id >= s->maxservice) {
+    atomic_fetch_sub(&s->nservice, 1);
+    return 0;
+  }
+  struct skynet_context* ctx = (struct skynet_context*)inc_malloc(sizeof(*ctx));
+  atomic_init(&ctx->in_global, 0);
+  ctx->handle = (uint32_t)id + 1;
+  ctx->cb = cb;
+  ctx->ud = ud;
+  ctx->sched = s;
+  skynet_mq_init(&ctx->mq);
+  atomic_store_explicit(&s->slot[id], ctx, memory_order_release);
+  return ctx->handle;
+}
+
+uint32_t skynet_context_handle(struct skynet_context* ctx) {
+  return ctx->handle;
+}
+
+struct skynet_scheduler* skynet_context_scheduler(struct skynet_context* ctx) {
+  return ctx->sched;
+}
@@ -0,0 +1,27 @@
+#ifndef __SKYNET_SERVER_H__
+#define __SKYNET_SERVER_H__
+
+#include "skynet_mq.h"
+
+struct skynet_context;
+struct skynet_scheduler;
+
+/*
+ * called with each message of the service, on whatever worker runs it. the
+ * callback owns 'msg': it frees it or sends it on with skynet_send.
+ */
+typedef void (*skynet_cb)(struct skynet_context* ctx, void* ud, struct skynet_message* msg);
+
+struct skynet_scheduler* skynet_scheduler_new(int nworker, int maxservice);
+void skynet_scheduler_start(struct skynet_scheduler* s);
+// joins the workers, messages still queued are freed
+void skynet_scheduler_delete(struct skynet_scheduler* s);
+
+uint32_t skynet_context_new(struct skynet_scheduler* s, skynet_cb cb, void* ud);
+uint32_t skynet_context_handle(struct skynet_context* ctx);
+struct skynet_scheduler* skynet_context_scheduler(struct skynet_context* ctx);
+
+// from a service or from any other thread; 'msg' belongs to 'dest' afterwards
+void skynet_send(struct skynet_scheduler* s, uint32_t source, uint32_t dest, struct skynet_message* msg);
+
+#endif